@@ -0,0 +1,49 @@
+// Compares replacing mentions by looping over every known user with a single scan plus hash lookup
+#include "../utils.hpp"
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+
+
+int main() {
+    const std::string message = "hey <@1000042> and <@!1000007>, did you see what <@999999999> posted? "
+                                "I think it was about the thing we talked about yesterday in the other channel";
+    constexpr unsigned iterations = 1000;
+
+    for (const unsigned user_count : {100u, 1000u, 10000u, 100000u}) {
+        std::unordered_map<uint64_t, std::string> users;
+        for (uint64_t id = 1000000; id != 1000000+user_count; id++) {
+            users.emplace(id, "user"+std::to_string(id));
+        }
+        size_t checksum = 0;
+
+        // Loop over all users, as on_message_create used to
+        utils::Timer timer;
+        for (unsigned it = 0; it != iterations; it++) {
+            auto content = message;
+            for (const auto& [id, username] : users) {
+                utils::str_replace_in_place(content, "<@"+std::to_string(id)+'>', username);
+            }
+            checksum += content.size();
+        }
+        const double loop_us = double(timer.get<std::chrono::microseconds>())/iterations;
+
+        // Single scan
+        timer.reset();
+        for (unsigned it = 0; it != iterations; it++) {
+            const auto content = utils::replace_mentions(message, [&users] (uint64_t id) -> std::optional<std::string> {
+                auto res = users.find(id);
+                if (res == users.end()) return {};
+                return res->second;
+            });
+            checksum += content.size();
+        }
+        const double scan_us = double(timer.get<std::chrono::microseconds>())/iterations;
+
+        std::cout << user_count << " users: " << loop_us << " us per message looping, "
+                  << scan_us << " us per message scanning (checksum " << checksum << ')' << std::endl;
+    }
+}
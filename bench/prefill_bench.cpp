@@ -0,0 +1,64 @@
+// Compares evaluating a message line by line with evaluating it at once in full-size batches and in chunks, as llm_append_chunked does
+#include "../utils.hpp"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <justlm.hpp>
+
+
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <model file> <text file> [batch size] [chunk size]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const auto text = utils::read_file(argv[2]);
+    LM::Inference::Params params;
+    params.n_threads = std::max(1u, std::thread::hardware_concurrency());
+    params.n_ctx = 2048;
+    params.n_batch = argc>3?std::stoi(argv[3]):64;
+    const size_t chunk_size = argc>4?std::stoul(argv[4]):512;
+
+    // Line by line, as non-instruct messages used to be evaluated
+    double linewise_ms;
+    {
+        std::unique_ptr<LM::Inference> inference(LM::Inference::construct(argv[1], params));
+        utils::Timer timer;
+        for (const auto line : utils::str_split(text, '\n')) {
+            inference->append(std::string(line)+'\n');
+        }
+        linewise_ms = timer.get<std::chrono::microseconds>()/1000.;
+    }
+
+    // All at once
+    double batched_ms;
+    {
+        std::unique_ptr<LM::Inference> inference(LM::Inference::construct(argv[1], params));
+        utils::Timer timer;
+        inference->append(text);
+        batched_ms = timer.get<std::chrono::microseconds>()/1000.;
+    }
+
+    // In chunks of prefill_chunk_size
+    double chunked_ms;
+    {
+        std::unique_ptr<LM::Inference> inference(LM::Inference::construct(argv[1], params));
+        utils::Timer timer;
+        for (std::string_view rest = text; !rest.empty();) {
+            const auto chunk = rest.substr(0, utils::get_chunk_size(rest, chunk_size));
+            inference->append(std::string(chunk));
+            rest.remove_prefix(chunk.size());
+        }
+        chunked_ms = timer.get<std::chrono::microseconds>()/1000.;
+    }
+
+    std::cout << "Line-wise: " << linewise_ms << " ms (" << text.size()/linewise_ms*1000. << " characters/s)\n"
+                 "Batched:   " << batched_ms << " ms (" << text.size()/batched_ms*1000. << " characters/s)\n"
+                 "Chunked:   " << chunked_ms << " ms (" << text.size()/chunked_ms*1000. << " characters/s)\n"
+                 "Speedup:   " << linewise_ms/batched_ms << "x batched, " << linewise_ms/chunked_ms << "x chunked" << std::endl;
+}
@@ -0,0 +1,53 @@
+#ifndef BLOOM_FILTER_HPP
+#define BLOOM_FILTER_HPP
+#include <vector>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+
+// Lock-free filter for 64 bit IDs; may report false positives but never false negatives
+class BloomFilter {
+    static constexpr unsigned hash_count = 4;
+
+    std::vector<std::atomic<uint64_t>> words;
+    uint64_t bit_mask;
+
+    static uint64_t mix(uint64_t x) {
+        // splitmix64 finalizer
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+        return x ^ (x >> 31);
+    }
+
+    std::array<uint64_t, hash_count> get_bits(uint64_t id) const {
+        std::array<uint64_t, hash_count> fres;
+        const uint64_t h1 = mix(id),
+                       h2 = mix(h1) | 1;
+        for (unsigned it = 0; it != hash_count; it++) {
+            fres[it] = (h1 + it * h2) & bit_mask;
+        }
+        return fres;
+    }
+
+public:
+    // Bit count must be a power of two and at least 64
+    BloomFilter(size_t bit_count) : words(bit_count / 64), bit_mask(bit_count - 1) {}
+
+    void add(uint64_t id) {
+        for (const auto bit : get_bits(id)) {
+            words[bit / 64].fetch_or(uint64_t(1) << (bit % 64), std::memory_order_relaxed);
+        }
+    }
+
+    bool maybe_contains(uint64_t id) const {
+        for (const auto bit : get_bits(id)) {
+            if (!(words[bit / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (bit % 64)))) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+#endif // BLOOM_FILTER_HPP
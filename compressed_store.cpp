@@ -0,0 +1,162 @@
+#include "compressed_store.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+
+
+CompressedStore::CompressedStore(size_t budget) : budget(budget) {
+    // Start worker
+    worker = std::thread([this] () {
+        worker_run();
+    });
+}
+
+CompressedStore::~CompressedStore() {
+    {
+        std::scoped_lock L(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    worker.join();
+}
+
+void CompressedStore::add(uint64_t key, const std::string& path) {
+    {
+        std::scoped_lock L(mutex);
+        queue.push_back({key, path, nullptr});
+    }
+    cv.notify_one();
+}
+
+void CompressedStore::restore(uint64_t key, const std::string& path, Callback callback) {
+    {
+        std::scoped_lock L(mutex);
+        // Someone is waiting for this, so it goes before compressions
+        queue.push_front({key, path, std::move(callback)});
+    }
+    cv.notify_one();
+}
+
+bool CompressedStore::contains(uint64_t key) {
+    std::scoped_lock L(mutex);
+    return entries.contains(key);
+}
+
+void CompressedStore::erase(std::unordered_map<uint64_t, Entry>::iterator entry) {
+    bytes -= entry->second.data.size();
+    bytes_uncompressed -= entry->second.size;
+    ages.erase(entry->second.age);
+    entries.erase(entry);
+}
+
+void CompressedStore::worker_run() {
+    std::unique_lock L(mutex);
+    for (;;) {
+        cv.wait(L, [this] () {return stop || !queue.empty();});
+        if (stop) break;
+        // Take job
+        auto job = std::move(queue.front());
+        queue.pop_front();
+        // Run it without holding the lock
+        L.unlock();
+        if (job.callback) {
+            job.callback(write_back(job.key, job.path));
+        } else {
+            compress(job.key, job.path);
+        }
+        L.lock();
+    }
+    // Don't leave anyone waiting
+    for (auto& job : queue) {
+        if (job.callback) job.callback(false);
+    }
+}
+
+void CompressedStore::compress(uint64_t key, const std::string& path) {
+    // Read file, making sure it isn't being replaced meanwhile
+    std::error_code ec;
+    const auto time = std::filesystem::last_write_time(path, ec);
+    if (ec) return;
+    std::string data;
+    try {
+        data = utils::read_file(path, true);
+    } catch (...) {
+        return;
+    }
+    if (std::filesystem::last_write_time(path, ec) != time || ec) return;
+    // Compress it, favoring speed over ratio
+    uLongf size = compressBound(data.size());
+    std::string compressed(size, '\0');
+    if (::compress2(reinterpret_cast<Bytef*>(compressed.data()), &size, reinterpret_cast<const Bytef*>(data.data()), data.size(), Z_BEST_SPEED) != Z_OK) {
+        Logger::get().warning("compressed_store", "Failed to compress {}", path);
+        return;
+    }
+    compressed.resize(size);
+    compressed.shrink_to_fit();
+    compressions++;
+    // Replace previous copy
+    std::scoped_lock L(mutex);
+    auto res = entries.find(key);
+    if (res != entries.end()) erase(res);
+    if (compressed.size() > budget) {
+        dropped++;
+        return;
+    }
+    bytes += compressed.size();
+    bytes_uncompressed += data.size();
+    entries.emplace(key, Entry{std::move(compressed), data.size(), time, ages.insert(ages.end(), key)});
+    // Drop least recently added copies until within budget, the files they came from are still there
+    while (bytes > budget) {
+        erase(entries.find(ages.front()));
+        dropped++;
+    }
+}
+
+bool CompressedStore::write_back(uint64_t key, const std::string& path) {
+    // Take copy, file will be up to date until it is written again
+    Entry entry;
+    {
+        std::scoped_lock L(mutex);
+        auto res = entries.find(key);
+        if (res == entries.end()) return false;
+        entry = std::move(res->second);
+        erase(res);
+    }
+    // Only restore unchanged files, anything else means the file got newer or deleted on purpose
+    std::error_code ec;
+    if (std::filesystem::last_write_time(path, ec) != entry.time || ec ||
+            std::filesystem::file_size(path, ec) != entry.size || ec) {
+        stale++;
+        return false;
+    }
+    // Decompress
+    std::string data(entry.size, '\0');
+    uLongf size = data.size();
+    if (::uncompress(reinterpret_cast<Bytef*>(data.data()), &size, reinterpret_cast<const Bytef*>(entry.data.data()), entry.data.size()) != Z_OK || size != data.size()) {
+        Logger::get().warning("compressed_store", "Failed to decompress copy of {}", path);
+        return false;
+    }
+    // Write it over the file so it's read from the page cache, contents are the same so this is safe to be interrupted
+    const int fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0) return false;
+    std::string_view rest = data;
+    while (!rest.empty()) {
+        const auto n = ::write(fd, rest.data(), rest.size());
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            Logger::get().warning("compressed_store", "Failed to write {}: {}", path, strerror(errno));
+            close(fd);
+            return false;
+        }
+        rest.remove_prefix(n);
+    }
+    close(fd);
+    restores++;
+    return true;
+}
@@ -0,0 +1,92 @@
+#ifndef COMPRESSED_STORE_HPP
+#define COMPRESSED_STORE_HPP
+#include <string>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+
+// Keeps zlib compressed copies of files in RAM up to a byte budget, so they can be restored without reading them from disk
+class CompressedStore {
+public:
+    using Callback = std::function<void (bool)>;
+
+private:
+    struct Entry {
+        std::string data;
+        size_t size; // Uncompressed
+        std::filesystem::file_time_type time; // Of file when it was compressed
+        std::list<uint64_t>::iterator age;
+    };
+    struct Job {
+        uint64_t key;
+        std::string path;
+        Callback callback; // Restore if set, compress otherwise
+    };
+
+    const size_t budget;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Job> queue;
+    std::unordered_map<uint64_t, Entry> entries;
+    std::list<uint64_t> ages; // Least recently added first
+    size_t bytes = 0,
+           bytes_uncompressed = 0;
+    std::thread worker;
+    bool stop = false;
+
+    std::atomic<uint64_t> compressions = 0,
+                          restores = 0,
+                          stale = 0,
+                          dropped = 0;
+
+    void worker_run();
+    void compress(uint64_t key, const std::string& path);
+    bool write_back(uint64_t key, const std::string& path);
+    void erase(std::unordered_map<uint64_t, Entry>::iterator entry);
+
+public:
+    CompressedStore(size_t budget);
+    ~CompressedStore();
+
+    // Compresses file on a background thread, least recently added copies are dropped once over budget
+    void add(uint64_t key, const std::string& path);
+    // Writes copy back into file on a background thread if the file hasn't changed since, callback receives whether it did
+    void restore(uint64_t key, const std::string& path, Callback callback);
+    // Whether there is a copy that has been compressed already
+    bool contains(uint64_t key);
+
+    size_t get_size() {
+        std::scoped_lock L(mutex);
+        return entries.size();
+    }
+    size_t get_bytes() {
+        std::scoped_lock L(mutex);
+        return bytes;
+    }
+    size_t get_bytes_uncompressed() {
+        std::scoped_lock L(mutex);
+        return bytes_uncompressed;
+    }
+    uint64_t get_compressions() const {
+        return compressions;
+    }
+    uint64_t get_restores() const {
+        return restores;
+    }
+    uint64_t get_stale() const {
+        return stale;
+    }
+    uint64_t get_dropped() const {
+        return dropped;
+    }
+};
+#endif // COMPRESSED_STORE_HPP
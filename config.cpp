@@ -5,9 +5,23 @@
 #include <fstream>
 #include <unordered_map>
 #include <filesystem>
+#include <algorithm>
+#include <cstdint>
 
 
 
+Logger::Level Configuration::parse_log_level(const std::string& value) {
+    if (value == "debug")
+        return Logger::Level::debug;
+    if (value == "info")
+        return Logger::Level::info;
+    if (value == "warning")
+        return Logger::Level::warning;
+    if (value == "error")
+        return Logger::Level::error;
+    throw Exception("Error: Failed to parse configuration file: Unknown log level (debug/info/warning/error): "+value);
+}
+
 std::unordered_map<std::string, std::string> Configuration::file_parser(const std::string& path) {
     std::unordered_map<std::string, std::string> fres;
     // Open file
@@ -32,6 +46,22 @@ std::unordered_map<std::string, std::string> Configuration::file_parser(const st
 }
 
 
+size_t Configuration::get_cgroup_memory_limit() {
+    // Try cgroup v2, then v1
+    for (const auto path : {"/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes"}) {
+        std::ifstream f(path);
+        std::string value;
+        if (!(f >> value)) continue;
+        if (value == "max") return 0;
+        const auto limit = std::stoull(value);
+        // v1 reports a huge number if unlimited
+        if (limit >= (size_t(1) << 60)) return 0;
+        return limit;
+    }
+    return 0;
+}
+
+
 extern "C" char **environ;
 std::unordered_map<std::string, std::string> Configuration::environment_parser() {
     std::unordered_map<std::string, std::string> fres;
@@ -51,6 +81,14 @@ void Configuration::Model::fill(const Configuration& cfg, std::unordered_map<std
             user_prompt = std::move(value);
         } else if (key == "bot_prompt") {
             bot_prompt = std::move(value);
+        } else if (key == "stop_sequences") {
+            // Comma separated, \n for line breaks
+            for (const auto seq : utils::str_split(value, ',')) {
+                auto& stop = stop_sequences.emplace_back(seq);
+                utils::str_replace_in_place(stop, "\\n", "\n");
+            }
+        } else if (key == "max_tokens") {
+            max_tokens = std::stoi(value);
         } else if (key == "instruct_mode_policy") {
             instruct_mode_policy = parse_instruct_mode_policy(value);
         } else if (key == "emits_eos") {
@@ -63,8 +101,33 @@ void Configuration::Model::fill(const Configuration& cfg, std::unordered_map<std
             throw Exception("Error: Failed to parse model configuration file: Unknown key: "+key);
         }
     }
+    // Build matcher for stop sequences
+    stop_matcher = utils::StringMatcher(stop_sequences);
     // Get full path
     weights_path = std::filesystem::path(cfg.models_dir)/weights_filename;
+    // Estimate size of contexts
+    context_size = estimate_context_size(weights_path, cfg.ctx_size);
+}
+
+size_t Configuration::Model::estimate_context_size(const std::string& weights_path, unsigned ctx_size) {
+    std::ifstream f(weights_path, std::ios::binary);
+    // Read LLaMA header, other formats are unknown
+    uint32_t magic = 0, version;
+    int32_t n_vocab, n_embd, n_mult, n_head, n_layer;
+    f.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    if (magic != 0x67676a74 /*ggjt*/ && magic != 0x67676d66 /*ggmf*/) return 0;
+    f.read(reinterpret_cast<char*>(&version), sizeof(version));
+    f.read(reinterpret_cast<char*>(&n_vocab), sizeof(n_vocab));
+    f.read(reinterpret_cast<char*>(&n_embd), sizeof(n_embd));
+    f.read(reinterpret_cast<char*>(&n_mult), sizeof(n_mult));
+    f.read(reinterpret_cast<char*>(&n_head), sizeof(n_head));
+    f.read(reinterpret_cast<char*>(&n_layer), sizeof(n_layer));
+    if (!f || n_embd <= 0 || n_layer <= 0) return 0;
+    // F16 keys and values for each layer plus logits
+    const size_t kv_size = size_t(n_layer)*ctx_size*n_embd*2*2 + size_t(n_vocab)*sizeof(float);
+    // Scratch and compute buffers llama.cpp allocates for each context, fitted to its tables for 7B to 65B models
+    const size_t scratch_size = size_t(n_embd)*(size_t(ctx_size)*16 + 257*1024);
+    return kv_size + scratch_size;
 }
 
 void Configuration::Model::check(std::string& model_name, bool& allow_non_instruct) const {
@@ -120,10 +183,26 @@ void Configuration::fill(std::unordered_map<std::string, std::string>&& map, boo
             models_dir = std::move(value);
         } else if (key == "texts_file") {
             texts_file = std::move(value);
+        } else if (key == "memory_budget") {
+            memory_budget = std::stoull(value)*1000000;
+        } else if (key == "typing_prefetch_budget") {
+            typing_prefetch_budget = std::stoull(value)*1000000;
+        } else if (key == "compressed_context_budget") {
+            compressed_context_budget = std::stoull(value)*1000000;
+        } else if (key == "journal_sync_interval") {
+            journal_sync_interval = std::stoi(value);
+        } else if (key == "snapshot_interval") {
+            snapshot_interval = std::stoi(value);
         } else if (key == "pool_size") {
             pool_size = std::stoi(value);
         } else if (key == "threads") {
             threads = std::stoi(value);
+        } else if (key == "llm_workers") {
+            llm_workers = std::stoi(value);
+        } else if (key == "batch_size") {
+            batch_size = std::stoi(value);
+        } else if (key == "prefill_chunk_size") {
+            prefill_chunk_size = std::stoi(value);
         } else if (key == "scroll_keep") {
             scroll_keep = std::stoi(value);
         } else if (key == "shard_count") {
@@ -138,12 +217,28 @@ void Configuration::fill(std::unordered_map<std::string, std::string>&& map, boo
             max_context_age = std::stoi(value);
         } else if (key == "random_response_chance") {
             random_response_chance = std::stoi(value);
+        } else if (key == "live_edit_interval") {
+            live_edit_interval = std::stoi(value);
+        } else if (key == "max_reply_messages") {
+            max_reply_messages = std::stoi(value);
+        } else if (key == "history_flush_size") {
+            history_flush_size = std::stoi(value);
+        } else if (key == "own_message_max_age") {
+            own_message_max_age = std::stoi(value);
+        } else if (key == "user_cache_size") {
+            user_cache_size = std::stoi(value);
         } else if (key == "mlock") {
             mlock = parse_bool(value);
         } else if (key == "live_edit") {
             live_edit = parse_bool(value);
         } else if (key == "threads_only") {
             threads_only = parse_bool(value);
+        } else if (key == "log_tokens") {
+            log_tokens = parse_bool(value);
+        } else if (key == "log_level") {
+            log_level = parse_log_level(value);
+        } else if (key == "lazy_init_cache") {
+            lazy_init_cache = parse_bool(value);
         } else if (key == "persistance") {
             persistance = parse_bool(value);
         } else if (!ignore_extra) {
@@ -167,6 +262,21 @@ void Configuration::check(bool allow_non_instruct) const {
     if (scroll_keep >= 99) {
         throw Exception("Error: Scroll_keep must be a non-float percentage and in a range of 0-99.");
     }
+    if (user_cache_size == 0) {
+        throw Exception("Error: User cache size must be above zero.");
+    }
+    if (llm_workers == 0) {
+        throw Exception("Error: There must be at least one LLM worker.");
+    }
+    if (llm_workers > pool_size) {
+        throw Exception("Error: There must be no more LLM workers than pool_size.");
+    }
+    if (max_reply_messages == 0) {
+        throw Exception("Error: Max. reply messages must be above zero.");
+    }
+    if (batch_size == 0) {
+        throw Exception("Error: Batch size must be above zero.");
+    }
     if (shard_count == 0) {
         throw Exception("Error: Shard count must be above zero.");
         exit(-13);
@@ -226,6 +336,15 @@ void Configuration::parse_configs(const std::string &main_file) {
             default_inference_model_cfg = &stored_model_cfg;
     }
 
+    // Default memory budget to what the cgroup leaves besides model weights
+    if (memory_budget == 0) {
+        memory_budget = get_cgroup_memory_limit();
+        for (const auto& [model_name, model] : models) {
+            const auto weights_size = std::filesystem::file_size(model.weights_path);
+            memory_budget -= std::min(memory_budget, weights_size);
+        }
+    }
+
     // Check main configuration
     check(allow_non_instruct);
 }
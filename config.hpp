@@ -1,9 +1,12 @@
 #ifndef CONFIGURATION_H
 #define CONFIGURATION_H
 #include <string>
+#include <vector>
 #include <unordered_map>
 #include <stdexcept>
 #include <filesystem>
+#include "logger.hpp"
+#include "utils.hpp"
 
 
 class Configuration {
@@ -20,6 +23,9 @@ class Configuration {
         throw Exception("Error: Failed to parse configuration file: Unknown bool (true/false): "+value);
     }
 
+    static
+    Logger::Level parse_log_level(const std::string& value);
+
     inline static
     bool file_exists(const auto& p) {
         // Make sure we don't respond to some file that is actually called "none"...
@@ -27,6 +33,9 @@ class Configuration {
         return std::filesystem::exists(p);
     }
 
+    static
+    size_t get_cgroup_memory_limit();
+
     static
     std::unordered_map<std::string, std::string> file_parser(const std::string& path);
     static
@@ -41,6 +50,10 @@ public:
                     weights_path,
                     user_prompt,
                     bot_prompt;
+        std::vector<std::string> stop_sequences;
+        utils::StringMatcher stop_matcher;
+        unsigned max_tokens = 0;
+        size_t context_size = 0; // Estimated bytes of RAM a context takes, 0 if unknown
         bool emits_eos = false,
              no_instruct_prompt = false,
              no_extra_linebreaks = false;
@@ -68,6 +81,9 @@ public:
             exit(-4);
         }
 
+        static
+        size_t estimate_context_size(const std::string& weights_path, unsigned ctx_size);
+
         void fill(const Configuration&, std::unordered_map<std::string, std::string>&&, bool ignore_extra = false);
         void check(std::string& model_name, bool& allow_non_instruct) const;
     };
@@ -94,15 +110,31 @@ public:
              pool_size = 2,
              timeout = 120,
              threads = 4,
+             llm_workers = 1,
+             batch_size = 64,
+             prefill_chunk_size = 512,
              scroll_keep = 20,
              shard_count = 1,
              shard_id = 0,
              max_context_age = 0,
-             random_response_chance = 0;
+             random_response_chance = 0,
+             history_flush_size = 2048,
+             live_edit_interval = 1000,
+             max_reply_messages = 4,
+             journal_sync_interval = 1000,
+             snapshot_interval = 900,
+             user_cache_size = 10000,
+             own_message_max_age = 604800;
+    size_t memory_budget = 0, // Bytes
+           typing_prefetch_budget = 256000000, // Bytes
+           compressed_context_budget = 512000000; // Bytes
     bool persistance = true,
          mlock = false,
          live_edit = false,
-         threads_only = true;
+         threads_only = true,
+         lazy_init_cache = false,
+         log_tokens = false;
+    Logger::Level log_level = Logger::Level::info;
     const Model *default_inference_model_cfg = nullptr;
 
     std::unordered_map<std::string, Model> models;
@@ -0,0 +1,133 @@
+#include "database.hpp"
+
+#include "logger.hpp"
+
+
+
+namespace {
+sqlite::database_binder prepare(sqlite::database& db, const std::string& sql) {
+    auto fres = db << sql;
+    // Don't execute on destruction
+    fres.used(true);
+    return fres;
+}
+}
+
+
+Database::Database(const std::string& path) : db(path) {
+    // Configure database
+    db << "PRAGMA journal_mode=WAL;";
+    db << "PRAGMA synchronous=NORMAL;";
+    // Create tables
+    db << "CREATE TABLE IF NOT EXISTS threads ("
+          "    id TEXT PRIMARY KEY NOT NULL,"
+          "    model TEXT,"
+          "    instruct_mode INTEGER,"
+          "    this_shard INTEGER,"
+          "    UNIQUE(id)"
+          ");";
+    db << "CREATE TABLE IF NOT EXISTS own_messages ("
+          "    id INTEGER PRIMARY KEY NOT NULL"
+          ");";
+    // Prepare statements
+    insert_thread_stmt.emplace(prepare(db, "INSERT INTO threads (id, model, instruct_mode, this_shard) VALUES (?, ?, ?, ?);"));
+    insert_own_message_stmt.emplace(prepare(db, "INSERT OR IGNORE INTO own_messages (id) VALUES (?);"));
+    delete_own_messages_stmt.emplace(prepare(db, "DELETE FROM own_messages WHERE id < ?;"));
+    // Start writer
+    writer = std::thread([this] () {
+        writer_run();
+    });
+}
+
+Database::~Database() {
+    // Stop writer after it's done
+    {
+        std::scoped_lock L(queue_mutex);
+        stop = true;
+    }
+    queue_cv.notify_all();
+    writer.join();
+}
+
+void Database::writer_run() {
+    std::vector<std::function<void ()>> batch;
+    while (true) {
+        // Take everything that's queued
+        {
+            std::unique_lock L(queue_mutex);
+            writing = false;
+            flush_cv.notify_all();
+            queue_cv.wait(L, [this] () {return !queue.empty() || stop;});
+            if (queue.empty()) return;
+            batch.swap(queue);
+            writing = true;
+        }
+        // Execute it in a single transaction
+        try {
+            db << "BEGIN;";
+            for (const auto& write : batch) {
+                try {
+                    write();
+                } catch (const std::exception& e) {
+                    Logger::get().warning("db", "Database write failed: {}", e.what());
+                }
+            }
+            db << "COMMIT;";
+        } catch (const std::exception& e) {
+            Logger::get().warning("db", "Database transaction failed: {}", e.what());
+        }
+        batch.clear();
+    }
+}
+
+void Database::enqueue(std::function<void ()>&& write) {
+    {
+        std::scoped_lock L(queue_mutex);
+        queue.push_back(std::move(write));
+    }
+    queue_cv.notify_one();
+}
+
+void Database::load_threads(const std::function<void (Thread&&)>& cb) {
+    db << "SELECT id, model, instruct_mode, this_shard FROM threads;"
+       >> [&](const std::string& id, const std::string& model, int instruct_mode, int this_shard) {
+        cb({std::stoull(id), model, bool(instruct_mode), bool(this_shard)});
+    };
+}
+
+void Database::load_own_messages(uint64_t min_id, const std::function<void (uint64_t)>& cb) {
+    db << "SELECT id FROM own_messages WHERE id >= ? ORDER BY id;"
+       << int64_t(min_id)
+       >> [&](int64_t id) {
+        cb(id);
+    };
+}
+
+void Database::add_thread(const Thread& thread) {
+    enqueue([this, thread] () {
+        auto& stmt = *insert_thread_stmt;
+        stmt << std::to_string(thread.id) << thread.model << thread.instruct_mode << thread.this_shard;
+        stmt++;
+    });
+}
+
+void Database::add_own_message(uint64_t id) {
+    enqueue([this, id] () {
+        auto& stmt = *insert_own_message_stmt;
+        stmt << int64_t(id);
+        stmt++;
+    });
+}
+
+void Database::remove_own_messages_before(uint64_t id) {
+    enqueue([this, id] () {
+        auto& stmt = *delete_own_messages_stmt;
+        stmt << int64_t(id);
+        stmt++;
+    });
+}
+
+void Database::flush() {
+    std::unique_lock L(queue_mutex);
+    flush_cv.wait(L, [this] () {return queue.empty() && !writing;});
+}
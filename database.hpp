@@ -0,0 +1,55 @@
+#ifndef DATABASE_HPP
+#define DATABASE_HPP
+#include "sqlite_modern_cpp/sqlite_modern_cpp.h"
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <cstdint>
+
+
+class Database {
+    sqlite::database db;
+    std::optional<sqlite::database_binder> insert_thread_stmt,
+                                           insert_own_message_stmt,
+                                           delete_own_messages_stmt;
+
+    std::thread writer;
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv,
+                            flush_cv;
+    std::vector<std::function<void ()>> queue;
+    bool writing = false,
+         stop = false;
+
+    void writer_run();
+    void enqueue(std::function<void ()>&&);
+
+public:
+    struct Thread {
+        uint64_t id;
+        std::string model;
+        bool instruct_mode,
+             this_shard;
+    };
+
+    Database(const std::string& path);
+    ~Database();
+
+    // Reads, these run synchronously and are only meant for startup
+    void load_threads(const std::function<void (Thread&&)>& cb);
+    void load_own_messages(uint64_t min_id, const std::function<void (uint64_t id)>& cb);
+
+    // Writes, these are batched and executed in the background
+    void add_thread(const Thread& thread);
+    void add_own_message(uint64_t id);
+    void remove_own_messages_before(uint64_t id);
+
+    // Blocks until all writes have been executed
+    void flush();
+};
+#endif // DATABASE_HPP
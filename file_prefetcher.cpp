@@ -0,0 +1,114 @@
+#include "file_prefetcher.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+
+FilePrefetcher::FilePrefetcher() {
+    // Start worker
+    worker = std::thread([this] () {
+        worker_run();
+    });
+}
+
+FilePrefetcher::~FilePrefetcher() {
+    {
+        std::scoped_lock L(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    worker.join();
+}
+
+std::shared_future<bool> FilePrefetcher::prefetch(const std::string& path, Callback callback) {
+    std::scoped_lock L(mutex);
+    // Share request if file is already being read
+    auto res = pending.find(path);
+    if (res == pending.end()) {
+        // Enqueue new request
+        auto& request = queue.emplace_back(Request{path, {}});
+        res = pending.emplace(path, Pending{request.promise.get_future().share(), {}}).first;
+        cv.notify_one();
+    }
+    if (callback) res->second.callbacks.push_back(std::move(callback));
+    return res->second.future;
+}
+
+void FilePrefetcher::finish(Request& request, bool ok, std::unique_lock<std::mutex>& lock) {
+    // Forget about request
+    std::vector<Callback> callbacks;
+    auto res = pending.find(request.path);
+    if (res != pending.end()) {
+        callbacks = std::move(res->second.callbacks);
+        pending.erase(res);
+    }
+    request.promise.set_value(ok);
+    // Call back without holding the lock
+    lock.unlock();
+    for (const auto& callback : callbacks) {
+        callback(ok);
+    }
+    lock.lock();
+}
+
+void FilePrefetcher::cancel(const std::string& path) {
+    {
+        std::unique_lock L(mutex);
+        // Remove request if it hasn't been started yet
+        auto res = std::find_if(queue.begin(), queue.end(), [&path] (const Request& request) {return request.path == path;});
+        if (res != queue.end()) {
+            auto request = std::move(*res);
+            queue.erase(res);
+            finish(request, false, L);
+            return;
+        }
+        // Let it finish if it's being read right now
+        if (pending.contains(path)) return;
+    }
+    // Give pages back
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+void FilePrefetcher::worker_run() {
+    std::unique_lock L(mutex);
+    for (;;) {
+        cv.wait(L, [this] () {return stop || !queue.empty();});
+        if (stop) break;
+        // Take request
+        auto request = std::move(queue.front());
+        queue.pop_front();
+        // Read file without holding the lock
+        L.unlock();
+        const bool ok = read(request.path);
+        L.lock();
+        finish(request, ok, L);
+    }
+    // Don't leave anyone waiting
+    while (!queue.empty()) {
+        auto request = std::move(queue.front());
+        queue.pop_front();
+        finish(request, false, L);
+    }
+}
+
+bool FilePrefetcher::read(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    // Hint kernel, then read through the file to make sure it's actually resident
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    std::vector<char> buffer(1 << 20);
+    ssize_t n;
+    while ((n = ::read(fd, buffer.data(), buffer.size())) > 0) {
+        bytes_read += n;
+    }
+    close(fd);
+    files_read++;
+    return n == 0;
+}
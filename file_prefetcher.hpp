@@ -0,0 +1,61 @@
+#ifndef FILE_PREFETCHER_HPP
+#define FILE_PREFETCHER_HPP
+#include <string>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <cstdint>
+
+
+// Reads files into the page cache on a background thread so whoever needs them next doesn't block on disk
+class FilePrefetcher {
+public:
+    using Callback = std::function<void (bool)>;
+
+private:
+    struct Request {
+        std::string path;
+        std::promise<bool> promise;
+    };
+    struct Pending {
+        std::shared_future<bool> future;
+        std::vector<Callback> callbacks;
+    };
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Request> queue;
+    std::unordered_map<std::string, Pending> pending;
+    std::thread worker;
+    bool stop = false;
+
+    std::atomic<uint64_t> files_read = 0,
+                          bytes_read = 0;
+
+    void worker_run();
+    bool read(const std::string& path);
+    void finish(Request& request, bool ok, std::unique_lock<std::mutex>& lock);
+
+public:
+    FilePrefetcher();
+    ~FilePrefetcher();
+
+    // Future turns true once file is in the page cache, false if it couldn't be read. Callback is called with the same on the I/O thread
+    std::shared_future<bool> prefetch(const std::string& path, Callback callback = nullptr);
+    // Drops file from the queue, or from the page cache if it has been read already
+    void cancel(const std::string& path);
+
+    uint64_t get_files_read() const {
+        return files_read;
+    }
+    uint64_t get_bytes_read() const {
+        return bytes_read;
+    }
+};
+#endif // FILE_PREFETCHER_HPP
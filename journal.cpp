@@ -0,0 +1,230 @@
+#include "journal.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+
+namespace {
+constexpr size_t header_size = sizeof(uint64_t)+sizeof(int64_t)+sizeof(uint8_t)+sizeof(uint32_t);
+
+template<typename T>
+void put(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+template<typename T>
+T get(const char *data) {
+    T fres;
+    std::memcpy(&fres, data, sizeof(fres));
+    return fres;
+}
+
+int64_t now() {
+    return std::filesystem::file_time_type::clock::now().time_since_epoch().count();
+}
+}
+
+
+Journal::Journal(const std::filesystem::path& directory, std::chrono::milliseconds sync_interval)
+        : directory(directory), sync_interval(sync_interval) {
+    std::filesystem::create_directories(directory);
+    // Find segments of previous runs
+    std::vector<unsigned> segments;
+    for (const auto& file : std::filesystem::directory_iterator(directory)) {
+        if (file.path().extension() != ".journal") continue;
+        try {
+            segments.push_back(std::stoul(file.path().stem().string()));
+        } catch (...) {}
+    }
+    std::sort(segments.begin(), segments.end());
+    // Load them in order
+    for (const auto segment : segments) {
+        load_segment(get_segment_path(segment));
+    }
+    // Continue in new segment
+    segment = segments.empty()?0:(segments.back()+1);
+    open_segment();
+    // Start writer
+    writer = std::thread([this] () {
+        writer_run();
+    });
+}
+
+Journal::~Journal() {
+    {
+        std::scoped_lock L(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    writer.join();
+    close(fd);
+}
+
+std::filesystem::path Journal::get_segment_path(unsigned segment) const {
+    return directory/(std::to_string(segment)+".journal");
+}
+
+void Journal::encode(std::string& out, uint64_t channel_id, int64_t time, bool reset, std::string_view text) {
+    const auto start = out.size();
+    put<uint64_t>(out, channel_id);
+    put<int64_t>(out, time);
+    put<uint8_t>(out, reset);
+    put<uint32_t>(out, text.size());
+    out.append(text);
+    // Checksum to detect records torn by a crash
+    put<uint64_t>(out, utils::fnv1a(std::string_view(out).substr(start)));
+}
+
+void Journal::load_segment(const std::filesystem::path& path) {
+    const auto data = utils::read_file(path, true);
+    size_t pos = 0;
+    while (data.size()-pos >= header_size) {
+        const char *record = data.data()+pos;
+        const auto size = get<uint32_t>(record+header_size-sizeof(uint32_t));
+        // Stop at incomplete or corrupt record
+        if (data.size()-pos-header_size < size+sizeof(uint64_t)) break;
+        const std::string_view checked(record, header_size+size);
+        if (get<uint64_t>(record+checked.size()) != utils::fnv1a(checked)) break;
+        pos += checked.size()+sizeof(uint64_t);
+        // Apply record
+        const auto channel_id = get<uint64_t>(record);
+        auto& entries = recovered[channel_id];
+        if (get<uint8_t>(record+sizeof(uint64_t)+sizeof(int64_t))) {
+            entries.clear();
+        } else {
+            entries.push_back({get<int64_t>(record+sizeof(uint64_t)), std::string(checked.substr(header_size))});
+        }
+    }
+    if (pos != data.size()) {
+        Logger::get().warning("journal", "Ignoring {} bytes of incomplete records in {}", data.size()-pos, path.string());
+    }
+}
+
+void Journal::open_segment() {
+    const auto path = get_segment_path(segment);
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        Logger::get().error("journal", "Failed to open {}: {}", path.string(), strerror(errno));
+    }
+}
+
+void Journal::write_data(std::string_view data) {
+    // Write everything, then make it durable
+    while (!data.empty()) {
+        const auto n = ::write(fd, data.data(), data.size());
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            Logger::get().error("journal", "Failed to write: {}", strerror(errno));
+            return;
+        }
+        data.remove_prefix(n);
+        bytes_written += n;
+    }
+    fdatasync(fd);
+    syncs++;
+}
+
+void Journal::write_buffer() {
+    std::scoped_lock F(file_mutex);
+    // Take buffer so appends don't wait for the disk
+    std::string data;
+    {
+        std::scoped_lock L(mutex);
+        data.swap(buffer);
+    }
+    if (!data.empty()) write_data(data);
+}
+
+void Journal::writer_run() {
+    std::unique_lock L(mutex);
+    while (!stop) {
+        cv.wait_for(L, sync_interval, [this] () {return stop || !rotations.empty();});
+        auto callbacks = std::move(rotations);
+        rotations.clear();
+        L.unlock();
+        if (callbacks.empty()) {
+            write_buffer();
+        } else {
+            // Rotating writes the buffer too
+            const auto segment = rotate();
+            for (const auto& callback : callbacks) {
+                callback(segment);
+            }
+        }
+        L.lock();
+    }
+}
+
+void Journal::append(uint64_t channel_id, std::string_view text) {
+    std::scoped_lock L(mutex);
+    encode(buffer, channel_id, now(), false, text);
+}
+
+void Journal::reset(uint64_t channel_id) {
+    std::scoped_lock L(mutex);
+    encode(buffer, channel_id, now(), true, {});
+    recovered.erase(channel_id);
+}
+
+std::vector<std::string> Journal::take_recovered(uint64_t channel_id, std::filesystem::file_time_type since) {
+    std::vector<std::string> fres;
+    std::scoped_lock L(mutex);
+    auto res = recovered.find(channel_id);
+    if (res == recovered.end()) return fres;
+    for (auto& entry : res->second) {
+        if (entry.time > since.time_since_epoch().count()) {
+            fres.push_back(std::move(entry.text));
+        }
+    }
+    recovered.erase(res);
+    replayed += fres.size();
+    return fres;
+}
+
+std::vector<uint64_t> Journal::get_recovered_channels() {
+    std::vector<uint64_t> fres;
+    std::scoped_lock L(mutex);
+    fres.reserve(recovered.size());
+    for (const auto& [channel_id, entries] : recovered) {
+        fres.push_back(channel_id);
+    }
+    return fres;
+}
+
+void Journal::rotate_async(std::function<void (unsigned)> callback) {
+    {
+        std::scoped_lock L(mutex);
+        rotations.push_back(std::move(callback));
+    }
+    cv.notify_all();
+}
+
+unsigned Journal::rotate() {
+    std::scoped_lock F(file_mutex);
+    std::string data;
+    {
+        std::scoped_lock L(mutex);
+        data.swap(buffer);
+    }
+    // Finish current segment and start next one
+    write_data(data);
+    close(fd);
+    segment++;
+    open_segment();
+    return segment;
+}
+
+void Journal::drop_segments_before(unsigned segment) {
+    std::error_code ec;
+    for (const auto& file : std::filesystem::directory_iterator(directory, ec)) {
+        if (file.path().extension() != ".journal") continue;
+        try {
+            if (std::stoul(file.path().stem().string()) < segment) std::filesystem::remove(file.path(), ec);
+        } catch (...) {}
+    }
+}
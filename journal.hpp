@@ -0,0 +1,80 @@
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+
+
+// Append-only log of text added to each context since its last snapshot, split into numbered segments
+class Journal {
+    struct Entry {
+        int64_t time; // file_clock ticks
+        std::string text;
+    };
+
+    const std::filesystem::path directory;
+    const std::chrono::milliseconds sync_interval;
+
+    std::mutex mutex; // Guards buffer, rotations and recovered
+    std::mutex file_mutex; // Guards fd and segment
+    std::condition_variable cv;
+    std::string buffer; // Records not yet written
+    std::vector<std::function<void (unsigned)>> rotations; // Callbacks of requested rotations
+    std::unordered_map<uint64_t, std::vector<Entry>> recovered; // Entries of previous run that haven't been replayed yet
+    int fd = -1;
+    unsigned segment = 0;
+    std::thread writer;
+    bool stop = false;
+
+    std::atomic<uint64_t> bytes_written = 0,
+                          syncs = 0,
+                          replayed = 0;
+
+    std::filesystem::path get_segment_path(unsigned segment) const;
+    static void encode(std::string& out, uint64_t channel_id, int64_t time, bool reset, std::string_view text);
+    void load_segment(const std::filesystem::path& path);
+    void open_segment();
+    void write_data(std::string_view data);
+    void write_buffer();
+    void writer_run();
+
+public:
+    Journal(const std::filesystem::path& directory, std::chrono::milliseconds sync_interval);
+    ~Journal();
+
+    // Record text added to a context, records become durable within the sync interval
+    void append(uint64_t channel_id, std::string_view text);
+    // Record that a context has been deleted
+    void reset(uint64_t channel_id);
+
+    // Returns text of previous run added after given time and forgets about it
+    std::vector<std::string> take_recovered(uint64_t channel_id, std::filesystem::file_time_type since);
+    // Returns channels with text of previous run that hasn't been taken yet, these must be taken before segments of previous run are dropped
+    std::vector<uint64_t> get_recovered_channels();
+
+    // Starts a new segment and returns its number, everything before it may be dropped once all contexts have been stored
+    unsigned rotate();
+    // Same as rotate, but done by the writer so the caller doesn't wait for the disk, callback receives segment number on the writer thread
+    void rotate_async(std::function<void (unsigned)> callback);
+    void drop_segments_before(unsigned segment);
+
+    uint64_t get_bytes_written() const {
+        return bytes_written;
+    }
+    uint64_t get_syncs() const {
+        return syncs;
+    }
+    uint64_t get_replayed() const {
+        return replayed;
+    }
+};
+#endif // JOURNAL_HPP
@@ -0,0 +1,113 @@
+#include "live_editor.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+
+
+
+LiveEditor::LiveEditor(dpp::cluster& bot, std::chrono::milliseconds min_interval)
+        : bot(bot), min_interval(min_interval), max_interval(std::max(min_interval, std::chrono::milliseconds(10000))) {
+    // Start sender
+    sender = std::thread([this] () {
+        sender_run();
+    });
+}
+
+LiveEditor::~LiveEditor() {
+    {
+        std::scoped_lock L(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    sender.join();
+}
+
+void LiveEditor::set(dpp::snowflake channel_id, dpp::snowflake message_id, std::string&& content, bool final) {
+    {
+        std::scoped_lock L(mutex);
+        auto [res, inserted] = messages.try_emplace(message_id);
+        auto& message = res->second;
+        if (inserted) {
+            message.channel_id = channel_id;
+            auto& channel = channels.try_emplace(channel_id, ChannelState{min_interval, Clock::now()}).first->second;
+            channel.users++;
+        }
+        // Replace content that hasn't been sent yet
+        if (message.dirty) edits_coalesced++;
+        message.content = std::move(content);
+        message.dirty = true;
+        message.final = message.final || final;
+    }
+    cv.notify_one();
+}
+
+void LiveEditor::send(dpp::snowflake message_id, MessageState& message, ChannelState& channel) {
+    // Build minimal message
+    dpp::message msg(message.channel_id, message.content);
+    msg.id = message_id;
+    // Mark as in flight
+    message.dirty = false;
+    message.in_flight = true;
+    channel.next_allowed = Clock::now() + channel.interval;
+    edits_sent++;
+    // Send it
+    bot.message_edit(msg, [this, message_id] (const dpp::confirmation_callback_t& ccb) {
+        const bool rate_limited = ccb.is_error() && ccb.http_info.status == 429;
+        if (ccb.is_error() && !rate_limited) {
+            Logger::get().warning("bot", "Failed to edit message: {}", ccb.get_error().message);
+        }
+        on_sent(message_id, rate_limited);
+    });
+}
+
+void LiveEditor::on_sent(dpp::snowflake message_id, bool rate_limited) {
+    {
+        std::scoped_lock L(mutex);
+        auto res = messages.find(message_id);
+        if (res == messages.end()) return;
+        auto& message = res->second;
+        message.in_flight = false;
+        auto& channel = channels.at(message.channel_id);
+        // Adapt interval to what Discord lets us do
+        if (rate_limited) {
+            edits_rate_limited++;
+            channel.interval = std::min(channel.interval * 2, max_interval);
+            channel.next_allowed = Clock::now() + channel.interval;
+            // Make sure the final content isn't lost
+            message.dirty = message.dirty || message.final;
+        } else {
+            channel.interval = std::max(channel.interval * 9 / 10, min_interval);
+        }
+        // Forget about message once its final content has been sent
+        if (message.final && !message.dirty) {
+            if (--channel.users == 0) channels.erase(message.channel_id);
+            messages.erase(res);
+        }
+    }
+    cv.notify_one();
+}
+
+void LiveEditor::sender_run() {
+    std::unique_lock L(mutex);
+    while (!stop) {
+        // Send whatever is due and find out when the next thing is
+        auto now = Clock::now();
+        auto next_wakeup = Clock::time_point::max();
+        for (auto& [message_id, message] : messages) {
+            if (!message.dirty || message.in_flight) continue;
+            auto& channel = channels.at(message.channel_id);
+            // Final content doesn't need to wait for the interval unless rate limited
+            if (now >= channel.next_allowed || (message.final && channel.interval == min_interval)) {
+                send(message_id, message, channel);
+            } else {
+                next_wakeup = std::min(next_wakeup, channel.next_allowed);
+            }
+        }
+        // Wait
+        if (next_wakeup == Clock::time_point::max()) {
+            cv.wait(L);
+        } else {
+            cv.wait_until(L, next_wakeup);
+        }
+    }
+}
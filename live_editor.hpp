@@ -0,0 +1,74 @@
+#ifndef LIVE_EDITOR_HPP
+#define LIVE_EDITOR_HPP
+#include <string>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <dpp/dpp.h>
+
+
+// Coalesces message edits; only the latest content of a message is sent, and only as often as Discord allows
+class LiveEditor {
+    using Clock = std::chrono::steady_clock;
+
+    struct MessageState {
+        dpp::snowflake channel_id;
+        std::string content;
+        bool dirty = false,
+             in_flight = false,
+             final = false;
+    };
+    struct ChannelState {
+        std::chrono::milliseconds interval;
+        Clock::time_point next_allowed;
+        unsigned users = 0;
+    };
+
+    dpp::cluster& bot;
+    const std::chrono::milliseconds min_interval,
+                                    max_interval;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::unordered_map<dpp::snowflake, MessageState> messages;
+    std::unordered_map<dpp::snowflake, ChannelState> channels;
+    std::thread sender;
+    bool stop = false;
+
+    std::atomic<uint64_t> edits_sent = 0,
+                          edits_coalesced = 0,
+                          edits_rate_limited = 0;
+
+    void sender_run();
+    void send(dpp::snowflake message_id, MessageState& message, ChannelState& channel);
+    void on_sent(dpp::snowflake message_id, bool rate_limited);
+    void set(dpp::snowflake channel_id, dpp::snowflake message_id, std::string&& content, bool final);
+
+public:
+    LiveEditor(dpp::cluster& bot, std::chrono::milliseconds min_interval);
+    ~LiveEditor();
+
+    // Sets the latest content, intermediate contents may never be sent
+    void update(dpp::snowflake channel_id, dpp::snowflake message_id, std::string content) {
+        set(channel_id, message_id, std::move(content), false);
+    }
+    // Sets the final content, it is sent as soon as any edit still in flight has completed
+    void finalize(dpp::snowflake channel_id, dpp::snowflake message_id, std::string content) {
+        set(channel_id, message_id, std::move(content), true);
+    }
+
+    uint64_t get_edits_sent() const {
+        return edits_sent;
+    }
+    uint64_t get_edits_coalesced() const {
+        return edits_coalesced;
+    }
+    uint64_t get_edits_rate_limited() const {
+        return edits_rate_limited;
+    }
+};
+#endif // LIVE_EDITOR_HPP
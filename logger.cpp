@@ -0,0 +1,108 @@
+#include "logger.hpp"
+
+#include <iostream>
+#include <chrono>
+
+
+
+Logger::Logger(size_t capacity) : buffer(capacity), mask(capacity-1) {
+    for (size_t idx = 0; idx != capacity; idx++) {
+        buffer[idx].sequence.store(idx, std::memory_order_relaxed);
+    }
+    // Start writer
+    writer = std::thread([this] () {
+        writer_run();
+    });
+}
+
+Logger::~Logger() {
+    stop = true;
+    writer.join();
+}
+
+Logger& Logger::get() {
+    static Logger logger;
+    return logger;
+}
+
+bool Logger::try_push(Entry&& entry) {
+    // Claim cell
+    Cell *cell;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        cell = &buffer[pos & mask];
+        const auto seq = cell->sequence.load(std::memory_order_acquire);
+        const auto diff = intptr_t(seq) - intptr_t(pos);
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            // Full
+            return false;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    // Fill it
+    cell->entry = std::move(entry);
+    cell->sequence.store(pos+1, std::memory_order_release);
+    return true;
+}
+
+bool Logger::try_pop(Entry& entry) {
+    // Claim cell
+    Cell *cell;
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        cell = &buffer[pos & mask];
+        const auto seq = cell->sequence.load(std::memory_order_acquire);
+        const auto diff = intptr_t(seq) - intptr_t(pos+1);
+        if (diff == 0) {
+            if (dequeue_pos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            // Empty
+            return false;
+        } else {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    // Empty it
+    entry = std::move(cell->entry);
+    cell->sequence.store(pos+mask+1, std::memory_order_release);
+    return true;
+}
+
+void Logger::writer_run() {
+    Entry entry;
+    while (true) {
+        // Anything logged before stopping is still written
+        const bool stopping = stop;
+        // Write everything that's queued
+        bool written = false;
+        while (try_pop(entry)) {
+            const char *level_str = "";
+            switch (entry.level) {
+            case Level::debug: level_str = "Debug"; break;
+            case Level::info: level_str = "Info"; break;
+            case Level::warning: level_str = "Warning"; break;
+            case Level::error: level_str = "Error"; break;
+            }
+            auto& out = entry.level>=Level::warning?std::cerr:std::cout;
+            out << level_str << " [" << entry.tag << "]: " << entry.message << '\n';
+            written = true;
+        }
+        if (written) {
+            std::cout.flush();
+            std::cerr.flush();
+        }
+        if (stopping) break;
+        // Wait for more
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+void Logger::log(Level level, const char *tag, std::string&& message) {
+    if (!is_enabled(level)) return;
+    if (!try_push({level, tag, std::move(message)})) {
+        dropped++;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <fmt/format.h>
+
+
+// Asynchronous logger; messages go into a lock-free ring buffer and are written out by a background thread
+class Logger {
+public:
+    enum class Level {
+        debug,
+        info,
+        warning,
+        error
+    };
+
+private:
+    struct Entry {
+        Level level;
+        const char *tag;
+        std::string message;
+    };
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Entry entry;
+    };
+
+    std::vector<Cell> buffer;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueue_pos = 0;
+    alignas(64) std::atomic<size_t> dequeue_pos = 0;
+    std::atomic<uint64_t> dropped = 0;
+    std::atomic<Level> min_level = Level::info;
+
+    std::thread writer;
+    std::atomic<bool> stop = false;
+
+    bool try_push(Entry&&);
+    bool try_pop(Entry&);
+    void writer_run();
+
+public:
+    // Capacity must be a power of two
+    Logger(size_t capacity = 8192);
+    ~Logger();
+
+    static Logger& get();
+
+    void set_level(Level level) {
+        min_level = level;
+    }
+    bool is_enabled(Level level) const {
+        return level >= min_level;
+    }
+    uint64_t get_dropped() const {
+        return dropped;
+    }
+
+    // Never blocks; messages are dropped if the buffer is full
+    void log(Level level, const char *tag, std::string&& message);
+
+    template<typename... Args>
+    void log(Level level, const char *tag, fmt::format_string<Args...> format, Args&&... args) {
+        if (!is_enabled(level)) return;
+        log(level, tag, fmt::format(format, std::forward<Args>(args)...));
+    }
+    template<typename... Args>
+    void debug(const char *tag, fmt::format_string<Args...> format, Args&&... args) {
+        log(Level::debug, tag, format, std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    void info(const char *tag, fmt::format_string<Args...> format, Args&&... args) {
+        log(Level::info, tag, format, std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    void warning(const char *tag, fmt::format_string<Args...> format, Args&&... args) {
+        log(Level::warning, tag, format, std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    void error(const char *tag, fmt::format_string<Args...> format, Args&&... args) {
+        log(Level::error, tag, format, std::forward<Args>(args)...);
+    }
+};
+#endif // LOGGER_HPP
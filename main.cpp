@@ -1,6 +1,13 @@
 #include "utils.hpp"
 #include "config.hpp"
-#include "sqlite_modern_cpp/sqlite_modern_cpp.h"
+#include "user_cache.hpp"
+#include "bloom_filter.hpp"
+#include "logger.hpp"
+#include "database.hpp"
+#include "live_editor.hpp"
+#include "file_prefetcher.hpp"
+#include "compressed_store.hpp"
+#include "journal.hpp"
 
 #include <string>
 #include <string_view>
@@ -11,9 +18,22 @@
 #include <functional>
 #include <vector>
 #include <unordered_map>
+#include <map>
+#include <unordered_set>
 #include <filesystem>
+#include <regex>
 #include <optional>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <queue>
+#include <deque>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
 #include <memory>
 #include <utility>
 #include <dpp/dpp.h>
@@ -26,13 +46,100 @@
 
 
 class Bot {
-    CoSched::ScheduledThread sched_thread;
-    LM::InferencePool llm_pool;
-    std::vector<dpp::snowflake> my_messages;
-    std::unordered_map<dpp::snowflake, dpp::user> users;
-    std::thread::id llm_tid;
-    utils::Timer cleanup_timer;
-    sqlite::database db;
+    inline static const std::string llm_pool_name = "discord_llama";
+
+    // Channels are busy for as long as they have a mailbox
+    struct ChannelMailbox {
+        std::deque<CoSched::Task*> waiting;
+    };
+    struct LLMWorker {
+        unsigned id;
+        CoSched::ScheduledThread sched_thread;
+        LM::InferencePool llm_pool;
+        struct PendingHistory {
+            std::string text;
+            const std::string *model_name;
+            const Configuration::Model *model;
+        };
+        std::unordered_map<dpp::snowflake, PendingHistory> pending_history;
+        std::unordered_map<dpp::snowflake, ChannelMailbox> channel_mailboxes;
+        std::unordered_map<dpp::snowflake, std::pair<const std::string*, const Configuration::Model*>> pool_slots; // Model of each slot
+        std::mutex memory_usage_mutex;
+        std::unordered_map<std::string, size_t> memory_usage; // Bytes per model
+        std::unordered_set<dpp::snowflake> resident_slots;
+
+        LLMWorker(unsigned id, size_t pool_size, bool persistance)
+            : id(id), llm_pool(pool_size, llm_pool_name, !persistance) {}
+    };
+    std::vector<std::unique_ptr<LLMWorker>> llm_workers;
+    inline static thread_local LLMWorker *current_llm_worker = nullptr;
+    struct ThreadInfo {
+        std::string model;
+        bool instruct_mode,
+             this_shard;
+    };
+    std::shared_mutex threads_mutex;
+    std::unordered_map<dpp::snowflake, ThreadInfo> threads;
+    std::atomic<uint64_t> thread_lookups = 0;
+    BloomFilter thread_filter{1 << 20}; // Threads on this shard
+    std::atomic<uint64_t> thread_filter_checks = 0,
+                          thread_filter_passes = 0,
+                          thread_filter_false_positives = 0;
+    std::mutex my_messages_mutex;
+    std::unordered_set<dpp::snowflake> my_messages;
+    std::deque<dpp::snowflake> my_messages_by_age;
+    UserCache users;
+    struct InitCache {
+        const Configuration::Model *model;
+        std::vector<std::string> prompts;
+        std::string path,
+                    data;
+        std::atomic<bool> queued = false,
+                          ready = false;
+        std::mutex waiters_mutex;
+        std::vector<std::function<void ()>> waiters; // Wake up tasks parked until cache is ready
+    };
+    std::unordered_map<std::string, InitCache> init_caches;
+    struct {
+        std::atomic<unsigned> hits = 0,
+                              misses = 0,
+                              builds = 0;
+        std::atomic<uint64_t> clone_time = 0; // In microseconds
+    } init_cache_stats;
+    struct {
+        std::atomic<unsigned> ram_hits = 0,
+                              compressed_hits = 0,
+                              disk_hits = 0,
+                              misses = 0;
+        std::atomic<uint64_t> promotion_time = 0, // In microseconds
+                              disk_restore_time = 0; // In microseconds
+    } pool_stats;
+    FilePrefetcher prefetcher;
+    std::optional<CompressedStore> compressed_store;
+    std::optional<Journal> journal;
+    utils::Timer snapshot_timer;
+    std::atomic<bool> snapshot_running = false;
+    struct TypingPrediction {
+        utils::Timer age;
+        size_t size;
+    };
+    std::mutex typing_predictions_mutex;
+    std::unordered_map<dpp::snowflake, TypingPrediction> typing_predictions;
+    size_t typing_prefetch_bytes = 0;
+    struct {
+        std::atomic<unsigned> predictions = 0,
+                              hits = 0,
+                              expired = 0;
+        std::atomic<uint64_t> hit_restore_time = 0; // In microseconds
+    } typing_prefetch_stats;
+    std::vector<std::thread> init_cache_builders;
+    std::mutex init_cache_queue_mutex;
+    std::condition_variable init_cache_queue_cv;
+    std::queue<InitCache*> init_cache_queue;
+    bool init_cache_builders_stop = false;
+    utils::Timer cleanup_timer,
+                 own_messages_prune_timer;
+    Database db;
 
     std::mutex command_completion_buffer_mutex;
     std::unordered_map<dpp::snowflake, dpp::slashcommand_t> command_completion_buffer;
@@ -41,6 +148,20 @@ class Bot {
     std::unordered_map<dpp::snowflake, dpp::message> thread_embeds;
 
     dpp::cluster bot;
+    LiveEditor live_editor;
+
+    // Message that is being created, LLM tasks may park until it has been
+    struct PendingMessage {
+        std::mutex mutex;
+        std::optional<dpp::message> msg;
+        std::vector<std::function<void ()>> waiters;
+
+        // Empty until message has been created, or if creating it failed
+        dpp::snowflake get_id() {
+            std::scoped_lock L(mutex);
+            return msg?msg->id:dpp::snowflake();
+        }
+    };
 
 public:    
     struct BotChannelConfig {
@@ -54,17 +175,25 @@ private:
 
     inline static
     bool show_console_progress(float progress) {
-        std::cout << ' ' << unsigned(progress) << "% \r" << std::flush;
+        Logger::get().debug("llm", "Evaluation progress: {}%", unsigned(progress));
         return true;
     }
 
     // Must run in llama thread
-#   define ENSURE_LLM_THREAD() if (std::this_thread::get_id() != llm_tid) {throw std::runtime_error("LLM execution of '"+std::string(__PRETTY_FUNCTION__)+"' on wrong thread detected");} 0
+#   define ENSURE_LLM_THREAD() if (current_llm_worker == nullptr) {throw std::runtime_error("LLM execution of '"+std::string(__PRETTY_FUNCTION__)+"' on wrong thread detected");} 0
+    // Must run in the llama thread of the worker owning the channel
+#   define ENSURE_LLM_CHANNEL_THREAD(id) if (current_llm_worker != &get_llm_worker(id)) {throw std::runtime_error("LLM execution of '"+std::string(__PRETTY_FUNCTION__)+"' on wrong worker detected");} 0
+
+    LLMWorker& get_llm_worker(dpp::snowflake channel_id) {
+        // Keep channels on the same worker so their contexts stay in its pool
+        return *llm_workers[utils::fnv1a(std::to_string(channel_id)) % llm_workers.size()];
+    }
 
     LM::Inference::Params llm_get_params(bool instruct_mode = false) const {
         return {
             .n_threads = config.threads,
             .n_ctx = config.ctx_size,
+            .n_batch = config.batch_size,
             .n_repeat_last = unsigned(instruct_mode?0:256),
             .temp = 0.3f,
             .repeat_penalty = instruct_mode?1.0f:1.372222224f,
@@ -86,8 +215,8 @@ private:
             }
             // Decrease priority
             task.set_priority(prio);
-            // Add snail reaction
-            if (!slow) {
+            // Add snail reaction once message has been sent
+            if (!slow && !msg.id.empty()) {
                 slow = 1;
                 bot.message_add_reaction(msg, "🐌");
             }
@@ -99,19 +228,65 @@ private:
     }
 
     // Must run in llama thread
-    bool llm_restart(const std::shared_ptr<LM::Inference>& inference, const BotChannelConfig& channel_cfg) {
+    // Parks current task until the wake function handed to start is called, from any thread
+    bool llm_park(const std::function<void (std::function<void ()>)>& start) {
         ENSURE_LLM_THREAD();
-        // Deserialize init cache if not instruct mode without prompt file
-        if (channel_cfg.instruct_mode && config.instruct_prompt_file == "none") return true;
-        const auto path = (*channel_cfg.model_name)+(channel_cfg.instruct_mode?"_instruct_init_cache":"_init_cache");
-        std::ifstream f(path, std::ios::binary);
-        if (!f) {
-            std::cerr << "Warning: Failed to init cache open file, consider regeneration: " << path << std::endl;
-            return false;
+        auto& task = CoSched::Task::get_current();
+        // Only ever touch the task from its own worker, and not at all once it stopped waiting
+        auto parked = std::make_shared<CoSched::Task*>(&task);
+        task.set_suspended(true);
+        start([worker = current_llm_worker, parked] () {
+            worker->sched_thread.create_task("Wakeup", [parked] () -> void {
+                if (*parked) (*parked)->set_suspended(false);
+            });
+        });
+        while (task.is_suspended()) {
+            if (!task.yield()) {
+                *parked = nullptr;
+                return false;
+            }
+        }
+        *parked = nullptr;
+        return true;
+    }
+
+    // Must run in llama thread
+    // Returns init cache once it's in RAM, nullptr if there is none to be used and nothing on error
+    std::optional<const InitCache*> llm_get_init_cache(const BotChannelConfig& channel_cfg) {
+        ENSURE_LLM_THREAD();
+        // No init cache if instruct mode without prompt file
+        if (channel_cfg.instruct_mode && config.instruct_prompt_file == "none") return nullptr;
+        const auto name = (*channel_cfg.model_name)+(channel_cfg.instruct_mode?"_instruct_init_cache":"_init_cache");
+        auto res = init_caches.find(name);
+        if (res == init_caches.end()) {
+            Logger::get().warning("llm", "No init cache for {}", name);
+            return {};
         }
+        auto& cache = res->second;
+        // Wait for init cache to become available in RAM
+        if (cache.ready) {
+            init_cache_stats.hits++;
+        } else {
+            init_cache_stats.misses++;
+        }
+        if (!init_cache_await(cache)) {
+            Logger::get().warning("llm", "Init cache unavailable: {}", cache.path);
+            return {};
+        }
+        return &cache;
+    }
+    // Must run in llama thread
+    bool llm_restart(const std::shared_ptr<LM::Inference>& inference, const InitCache *cache) {
+        ENSURE_LLM_THREAD();
+        // Deserialize init cache if there is one
+        if (!cache) return true;
+        // Clone init cache into inference
+        utils::Timer clone_timer;
+        utils::MemoryInputStream f(cache->data);
         if (!inference->deserialize(f)) {
             return false;
         }
+        init_cache_stats.clone_time += clone_timer.get<std::chrono::microseconds>();
         // Set params
         inference->params.n_ctx_window_top_bar = inference->get_context_size();
         inference->params.scroll_keep = float(config.scroll_keep) * 0.01f;
@@ -119,22 +294,156 @@ private:
     }
     // Must run in llama thread
     std::shared_ptr<LM::Inference> llm_start(dpp::snowflake id, const BotChannelConfig& channel_cfg) {
-        ENSURE_LLM_THREAD();
-        // Get or create inference
-        auto inference = llm_pool.create_inference(id, channel_cfg.model->weights_path, llm_get_params(channel_cfg.instruct_mode));
-        if (!llm_restart(inference, channel_cfg)) {
-            std::cerr << "Warning: Failed to deserialize cache: " << inference->get_last_error() << std::endl;
+        ENSURE_LLM_CHANNEL_THREAD(id);
+        // Wait for init cache before taking a slot, other channels may make the pool evict it in the meantime
+        const auto cache = llm_get_init_cache(channel_cfg);
+        if (!cache) return nullptr;
+        // Create inference and clone init cache into it without yielding in between
+        auto inference = current_llm_worker->llm_pool.create_inference(id, channel_cfg.model->weights_path, llm_get_params(channel_cfg.instruct_mode));
+        if (!llm_restart(inference, *cache)) {
+            Logger::get().warning("llm", "Failed to deserialize cache: {}", inference->get_last_error());
             return nullptr;
         }
         return inference;
     }
 
+    static
+    std::string llm_get_slot_path(dpp::snowflake id) {
+        // Must match naming of LM::InferencePool
+        return "LMInferencePool_"+llm_pool_name+'_'+std::to_string(id);
+    }
+
+    void typing_prefetch_expire() {
+        std::scoped_lock L(typing_predictions_mutex);
+        // Typing indicators last 10 seconds, so there should have been a message by now
+        for (auto it = typing_predictions.begin(); it != typing_predictions.end();) {
+            if (it->second.age.get<std::chrono::seconds>() > 20) {
+                prefetcher.cancel(llm_get_slot_path(it->first));
+                typing_prefetch_bytes -= it->second.size;
+                typing_prefetch_stats.expired++;
+                it = typing_predictions.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+    void typing_prefetch(dpp::snowflake channel_id) {
+        typing_prefetch_expire();
+        // Only prefetch contexts of threads on this shard that aren't in RAM already
+        const auto thread_info = get_thread_info(channel_id);
+        if (!thread_info || !thread_info->this_shard) return;
+        {
+            auto& worker = get_llm_worker(channel_id);
+            std::scoped_lock L(worker.memory_usage_mutex);
+            if (worker.resident_slots.contains(channel_id)) return;
+        }
+        std::scoped_lock L(typing_predictions_mutex);
+        // Keep existing prediction alive while user is still typing
+        auto res = typing_predictions.find(channel_id);
+        if (res != typing_predictions.end()) {
+            res->second.age.reset();
+            return;
+        }
+        // Check that slot fits into budget
+        const auto slot_path = llm_get_slot_path(channel_id);
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(slot_path, ec);
+        if (ec || typing_prefetch_bytes+size > config.typing_prefetch_budget) return;
+        // Start prefetching
+        typing_predictions.emplace(channel_id, TypingPrediction{{}, size});
+        typing_prefetch_bytes += size;
+        typing_prefetch_stats.predictions++;
+        prefetcher.prefetch(slot_path);
+    }
+    bool typing_prefetch_take(dpp::snowflake channel_id) {
+        std::scoped_lock L(typing_predictions_mutex);
+        auto res = typing_predictions.find(channel_id);
+        if (res == typing_predictions.end()) return false;
+        typing_prefetch_bytes -= res->second.size;
+        typing_predictions.erase(res);
+        return true;
+    }
+
     // Must run in llama thread
-    std::shared_ptr<LM::Inference> llm_get_inference(dpp::snowflake id, const BotChannelConfig& channel_cfg) {
+    void llm_update_memory_usage() {
         ENSURE_LLM_THREAD();
-        // Get inference
-        auto fres = llm_pool.get_inference(id);
-        if (!fres) {
+        auto& worker = *current_llm_worker;
+        // Sum up size of contexts in RAM, forgetting about slots that are gone
+        decltype(worker.pool_slots) pool_slots;
+        std::unordered_map<std::string, size_t> memory_usage;
+        std::unordered_set<dpp::snowflake> resident_slots;
+        for (const auto id : worker.llm_pool.get_active_slot_ids()) {
+            auto res = worker.pool_slots.find(id);
+            if (res == worker.pool_slots.end()) continue;
+            const auto [model_name, model] = res->second;
+            memory_usage[*model_name] += model->context_size;
+            resident_slots.insert(id);
+            pool_slots.insert(*res);
+        }
+        // Keep compressed copies of slots the pool has just evicted to disk
+        if (compressed_store) {
+            for (const auto& [id, slot] : worker.pool_slots) {
+                if (!pool_slots.contains(id)) compressed_store->add(id, llm_get_slot_path(id));
+            }
+        }
+        worker.pool_slots = std::move(pool_slots);
+        std::scoped_lock L(worker.memory_usage_mutex);
+        worker.memory_usage = std::move(memory_usage);
+        worker.resident_slots = std::move(resident_slots);
+    }
+
+    // Must run in llama thread
+    std::shared_ptr<LM::Inference> llm_get_inference(dpp::snowflake id, const BotChannelConfig& channel_cfg) {
+        ENSURE_LLM_CHANNEL_THREAD(id);
+        // Get inference, noting which tier it came from
+        const auto active_slots = current_llm_worker->llm_pool.get_active_slot_ids();
+        const bool in_ram = std::find(active_slots.begin(), active_slots.end(), id) != active_slots.end();
+        const bool predicted = typing_prefetch_take(id);
+        utils::Timer restore_timer;
+        std::filesystem::file_time_type slot_time = std::filesystem::file_time_type::min();
+        bool promoted = false;
+        if (!in_ram) {
+            const auto slot_path = llm_get_slot_path(id);
+            std::error_code ec;
+            slot_time = std::filesystem::last_write_time(slot_path, ec);
+            if (!ec) {
+                // Restore slot from its compressed copy if there is one
+                if (compressed_store && compressed_store->contains(id)) {
+                    auto restored = std::make_shared<std::atomic<bool>>(false);
+                    llm_park([&] (std::function<void ()> wake) {
+                        compressed_store->restore(id, slot_path, [restored, wake = std::move(wake)] (bool ok) {
+                            *restored = ok;
+                            wake();
+                        });
+                    });
+                    promoted = *restored;
+                }
+                // Otherwise park while slot is read from disk so other channels can continue
+                if (!promoted) {
+                    llm_park([&] (std::function<void ()> wake) {
+                        prefetcher.prefetch(slot_path, [wake = std::move(wake)] (bool) {
+                            wake();
+                        });
+                    });
+                }
+            }
+        }
+        auto fres = current_llm_worker->llm_pool.get_inference(id);
+        if (in_ram) {
+            pool_stats.ram_hits++;
+        } else if (fres && promoted) {
+            pool_stats.compressed_hits++;
+            pool_stats.promotion_time += restore_timer.get<std::chrono::microseconds>();
+        } else if (fres) {
+            const auto restore_time = restore_timer.get<std::chrono::microseconds>();
+            pool_stats.disk_hits++;
+            pool_stats.disk_restore_time += restore_time;
+            if (predicted) {
+                typing_prefetch_stats.hits++;
+                typing_prefetch_stats.hit_restore_time += restore_time;
+            }
+        } else {
+            pool_stats.misses++;
             // Start new inference
             fres = llm_start(id, channel_cfg);
             // Check for error
@@ -142,103 +451,382 @@ private:
                 return nullptr;
             }
         }
+        // Replay what was added after the slot had last been stored by a previous run
+        if (journal && !in_ram) {
+            // Generated text is journaled token by token, so evaluate it all at once
+            std::string text;
+            for (const auto& entry : journal->take_recovered(id, slot_time)) {
+                text += entry;
+            }
+            if (!text.empty() && !llm_append_chunked(id, fres, channel_cfg, text, show_console_progress, false)) {
+                Logger::get().warning("llm", "Failed to replay journal: {}", fres->get_last_error());
+            }
+        }
+        llm_track_inference(id, fres, channel_cfg);
+        // Return inference
+        return fres;
+    }
+    // Must run in llama thread
+    void llm_track_inference(dpp::snowflake id, const std::shared_ptr<LM::Inference>& inference, const BotChannelConfig& channel_cfg) {
+        ENSURE_LLM_CHANNEL_THREAD(id);
+        // Remember model of slot for memory usage
+        current_llm_worker->pool_slots[id] = {channel_cfg.model_name, channel_cfg.model};
+        llm_update_memory_usage();
         // Set scroll callback
-        fres->set_scroll_callback([msg = dpp::message(), channel_id = id] (float progress) {
-            std::cout << "WARNING: " << channel_id << " is scrolling! " << progress << "% \r" << std::flush;
+        inference->set_scroll_callback([msg = dpp::message(), channel_id = id] (float progress) {
+            Logger::get().warning("llm", "{} is scrolling! {}%", uint64_t(channel_id), progress);
             return true;
         });
-        // Return inference
-        return fres;
     }
-
     // Must run in llama thread
-    void llm_init() {
-        // Run at high priority
-        CoSched::Task::get_current().set_priority(CoSched::PRIO_HIGHER);
-        // Set LLM thread
-        llm_tid = std::this_thread::get_id();
+    // Gets inference again after the task yielded or parked, other channels may have made the pool store and evict it in the meantime
+    bool llm_refetch_inference(dpp::snowflake id, std::shared_ptr<LM::Inference>& inference, const BotChannelConfig& channel_cfg) {
+        ENSURE_LLM_CHANNEL_THREAD(id);
+        auto fres = current_llm_worker->llm_pool.get_inference(id);
+        if (!fres) {
+            Logger::get().warning("llm", "Lost context of {} while yielding", uint64_t(id));
+            return false;
+        }
+        if (fres != inference) {
+            Logger::get().debug("llm", "Context of {} got evicted while yielding, continuing in restored one", uint64_t(id));
+            inference = std::move(fres);
+            llm_track_inference(id, inference, channel_cfg);
+        }
+        return true;
+    }
+
+    bool init_cache_load(InitCache& cache) {
+        try {
+            cache.data = utils::read_file(cache.path, true);
+        } catch (...) {
+            return false;
+        }
+        return true;
+    }
+
+    std::string init_cache_get_path(const std::string& name, const Configuration::Model& model_config, const std::vector<std::string>& prompts) const {
+        const auto params = llm_get_params();
+        // Hash everything the resulting state depends on
+        uint64_t hash = utils::fnv1a(model_config.weights_path);
+        hash = utils::fnv1a(std::to_string(std::filesystem::file_size(model_config.weights_path)), hash);
+        hash = utils::fnv1a(std::to_string(std::filesystem::last_write_time(model_config.weights_path).time_since_epoch().count()), hash);
+        for (const auto& prompt : prompts) {
+            hash = utils::fnv1a(prompt, hash);
+            hash = utils::fnv1a(std::string_view("\0", 1), hash);
+        }
+        hash = utils::fnv1a(bot.me.username, hash);
+        hash = utils::fnv1a(fmt::format("{} {} {} {}", params.n_ctx, params.n_repeat_last, params.temp, params.repeat_penalty), hash);
+        // Return path including hash
+        return fmt::format("{}_{:016x}", name, hash);
+    }
+
+    void init_cache_build(InitCache& cache) const {
+        auto llm = LM::Inference::construct(cache.model->weights_path, llm_get_params());
         // Set scroll callback
-        auto scroll_cb = [] (float) {
+        llm->set_scroll_callback([] (float) {
             std::cerr << "Error: Prompt doesn't fit into max. context size!" << std::endl;
             abort();
             return false;
-        };
-        // Build init caches
-        std::string filename;
+        });
+        // Add initial context
+        for (const auto& prompt : cache.prompts) {
+            llm->append(prompt);
+        }
+        // Serialize end result
+        std::ofstream f(cache.path, std::ios::binary);
+        llm->serialize(f);
+        delete llm;
+    }
+
+    void init_cache_prepare() {
+        std::unordered_set<std::string> init_cache_paths;
         for (const auto& [model_name, model_config] : config.models) {
-            //TODO: Add hashes to regenerate these as needed
             // Standard prompt
-            filename = model_name+"_init_cache";
-            if (model_config.is_non_instruct_mode_allowed() &&
-                    !std::filesystem::exists(filename) && config.prompt_file != "none") {
-                std::cout << "Building init_cache for "+model_name+"..." << std::endl;
-                auto llm = LM::Inference::construct(model_config.weights_path, llm_get_params());
-                // Add initial context
+            if (model_config.is_non_instruct_mode_allowed() && config.prompt_file != "none") {
+                // Read prompt file
                 std::string prompt;
-                {
-                    // Read whole file
-                    std::ifstream f(config.prompt_file);
-                    if (!f) {
-                        // Clean up and abort on error
-                        std::cerr << "Error: Failed to open prompt file." << std::endl;
-                        abort();
-                    }
-                    std::ostringstream sstr;
-                    sstr << f.rdbuf();
-                    prompt = sstr.str();
+                try {
+                    prompt = utils::read_file(config.prompt_file);
+                } catch (...) {
+                    std::cerr << "Error: Failed to open prompt file." << std::endl;
+                    abort();
                 }
-                // Append
+                // Format prompt
                 using namespace fmt::literals;
                 if (prompt.back() != '\n') prompt.push_back('\n');
-                llm->set_scroll_callback(scroll_cb);
-                llm->append(fmt::format(fmt::runtime(prompt), "bot_name"_a=bot.me.username), show_console_progress);
-                // Serialize end result
-                std::ofstream f(filename, std::ios::binary);
-                llm->serialize(f);
+                // Register init cache
+                auto& cache = init_caches[model_name+"_init_cache"];
+                cache.model = &model_config;
+                cache.prompts = {fmt::format(fmt::runtime(prompt), "bot_name"_a=bot.me.username)};
+                cache.path = init_cache_get_path(model_name+"_init_cache", model_config, cache.prompts);
+                init_cache_paths.insert(cache.path);
             }
             // Instruct prompt
-            filename = model_name+"_instruct_init_cache";
-            if (model_config.is_instruct_mode_allowed() &&
-                    !std::filesystem::exists(filename)) {
-                std::cout << "Building instruct_init_cache for "+model_name+"..." << std::endl;
-                auto llm = LM::Inference::construct(model_config.weights_path, llm_get_params());
-                // Add initial context
-                std::string prompt;
+            if (model_config.is_instruct_mode_allowed()) {
+                std::vector<std::string> prompts;
                 if (config.instruct_prompt_file != "none" && !model_config.no_instruct_prompt) {
-                    // Read whole file
-                    std::ifstream f(config.instruct_prompt_file);
-                    if (!f) {
-                        // Clean up and abort on error
+                    // Read instruct prompt file
+                    std::string prompt;
+                    try {
+                        prompt = utils::read_file(config.instruct_prompt_file);
+                    } catch (...) {
                         std::cerr << "Error: Failed to open instruct prompt file." << std::endl;
                         abort();
                     }
-                    std::ostringstream sstr;
-                    sstr << f.rdbuf();
-                    prompt = sstr.str();
-                    // Append instruct prompt
+                    // Format instruct prompt
                     using namespace fmt::literals;
                     if (prompt.back() != '\n' && !model_config.no_extra_linebreaks) prompt.push_back('\n');
-                    llm->set_scroll_callback(scroll_cb);
-                    llm->append(fmt::format(fmt::runtime(prompt), "bot_name"_a=bot.me.username, "bot_prompt"_a=model_config.bot_prompt, "user_prompt"_a=model_config.user_prompt)+(model_config.no_extra_linebreaks?"":"\n\n")+model_config.user_prompt, show_console_progress);
+                    prompts.push_back(fmt::format(fmt::runtime(prompt), "bot_name"_a=bot.me.username, "bot_prompt"_a=model_config.bot_prompt, "user_prompt"_a=model_config.user_prompt)+(model_config.no_extra_linebreaks?"":"\n\n")+model_config.user_prompt);
                 }
                 // Append user prompt
-                llm->append(model_config.user_prompt);
-                // Serialize end result
-                std::ofstream f(filename, std::ios::binary);
-                llm->serialize(f);
+                prompts.push_back(model_config.user_prompt);
+                // Register init cache
+                auto& cache = init_caches[model_name+"_instruct_init_cache"];
+                cache.model = &model_config;
+                cache.prompts = std::move(prompts);
+                cache.path = init_cache_get_path(model_name+"_instruct_init_cache", model_config, cache.prompts);
+                init_cache_paths.insert(cache.path);
+            }
+        }
+        // Remove stale init caches
+        static const std::regex init_cache_regex(".+_init_cache(_[0-9a-f]{16})?");
+        for (const auto& file : std::filesystem::directory_iterator(".")) {
+            const auto filename = file.path().filename().string();
+            if (!file.is_regular_file() || init_cache_paths.contains(filename) ||
+                    !std::regex_match(filename, init_cache_regex)) continue;
+            Logger::get().info("init", "Removing stale init cache {}...", filename);
+            std::filesystem::remove(file.path());
+        }
+    }
+
+    void init_cache_enqueue(InitCache& cache) {
+        // Make sure it's queued only once
+        if (cache.queued.exchange(true)) return;
+        // Add to queue
+        {
+            std::scoped_lock L(init_cache_queue_mutex);
+            init_cache_queue.push(&cache);
+        }
+        init_cache_queue_cv.notify_one();
+    }
+
+    void init_cache_builder() {
+        while (true) {
+            // Get next init cache from queue
+            InitCache *cache;
+            {
+                std::unique_lock L(init_cache_queue_mutex);
+                init_cache_queue_cv.wait(L, [this] () {return !init_cache_queue.empty() || init_cache_builders_stop;});
+                if (init_cache_builders_stop) return;
+                cache = init_cache_queue.front();
+                init_cache_queue.pop();
+            }
+            // Build init cache unless an up to date one exists already
+            if (!std::filesystem::exists(cache->path)) {
+                Logger::get().info("init", "Building {}...", cache->path);
+                init_cache_build(*cache);
+                init_cache_stats.builds++;
+            }
+            // Load it into RAM
+            if (!init_cache_load(*cache)) {
+                Logger::get().warning("init", "Failed to load init cache: {}", cache->path);
+            }
+            decltype(cache->waiters) waiters;
+            {
+                std::scoped_lock L(cache->waiters_mutex);
+                cache->ready = true;
+                waiters.swap(cache->waiters);
+            }
+            for (const auto& wake : waiters) {
+                wake();
+            }
+            Logger::get().info("init", "Init cache {} is ready!", cache->path);
+        }
+    }
+
+    void init_cache_start() {
+        init_cache_prepare();
+        // Start as many builders as there is space for on this machine
+        const unsigned builder_count = std::max(1u, std::thread::hardware_concurrency()/config.threads);
+        for (unsigned it = 0; it != builder_count; it++) {
+            init_cache_builders.emplace_back([this] () {
+                init_cache_builder();
+            });
+        }
+        // Queue all init caches unless they're to be built lazily
+        if (!config.lazy_init_cache) {
+            for (auto& [name, cache] : init_caches) {
+                init_cache_enqueue(cache);
             }
         }
-        // Report complete init
-        std::cout << "Init done!" << std::endl;
     }
 
     // Must run in llama thread
-    bool prompt_add_msg(const dpp::message& msg, const BotChannelConfig& channel_cfg) {
+    bool init_cache_await(InitCache& cache) {
         ENSURE_LLM_THREAD();
+        // Queue init cache in case it's built lazily
+        init_cache_enqueue(cache);
+        // Park until builder wakes us up
+        if (!cache.ready && !llm_park([&cache] (std::function<void ()> wake) {
+                std::scoped_lock L(cache.waiters_mutex);
+                if (cache.ready) {
+                    wake();
+                } else {
+                    cache.waiters.push_back(std::move(wake));
+                }
+            })) {
+            return false;
+        }
+        return !cache.data.empty();
+    }
+
+    void llm_init(LLMWorker& worker) {
+        // Set LLM thread
+        current_llm_worker = &worker;
+        // Find cores we may run on, as limited by cpusets or taskset
+        std::vector<unsigned> cpus;
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        if (sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0) {
+            for (unsigned cpu = 0; cpu != CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &cpuset)) cpus.push_back(cpu);
+            }
+        } else {
+            Logger::get().warning("llm", "Failed to get CPU affinity: {}", strerror(errno));
+        }
+        // Pin worker to its own slice of them, threads spawned for inference inherit this
+        if (config.llm_workers*config.threads <= cpus.size()) {
+            CPU_ZERO(&cpuset);
+            for (unsigned idx = worker.id*config.threads; idx != (worker.id+1)*config.threads; idx++) {
+                CPU_SET(cpus[idx], &cpuset);
+            }
+            const int error = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+            if (error) {
+                Logger::get().warning("llm", "Failed to pin LLM worker {}: {}", worker.id, strerror(error));
+            }
+        } else if (worker.id == 0) {
+            Logger::get().warning("llm", "Not enough CPU cores to give each LLM worker its own ({} available), not pinning workers", cpus.size());
+        }
+    }
+
+    // Must run in llama thread
+    bool llm_append(dpp::snowflake id, const std::shared_ptr<LM::Inference>& inference, const std::string& text, const LM::AppendCallback& cb = nullptr) {
+        ENSURE_LLM_CHANNEL_THREAD(id);
+        if (!inference->append(text, cb)) return false;
+        if (journal) journal->append(id, text);
+        return true;
+    }
+    // Must run in llama thread
+    bool llm_append_chunked(dpp::snowflake id, std::shared_ptr<LM::Inference>& inference, const BotChannelConfig& channel_cfg, std::string_view text, const LM::AppendCallback& cb, bool journaled = true) {
+        ENSURE_LLM_CHANNEL_THREAD(id);
+        auto& task = CoSched::Task::get_current();
+        while (!text.empty()) {
+            // Get next chunk, preferably ending at a line break or space
+            const auto chunk = text.substr(0, utils::get_chunk_size(text, config.prefill_chunk_size));
+            // Append it
+            if (!inference->append(std::string(chunk), cb)) {
+                return false;
+            }
+            // Journal each chunk as it's evaluated since the context may be stored while yielding
+            if (journal && journaled) journal->append(id, chunk);
+            text.remove_prefix(chunk.size());
+            // Let other tasks run in between chunks
+            if (!text.empty() && (!task.yield() || !llm_refetch_inference(id, inference, channel_cfg))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Must run in llama thread
+    bool channel_acquire(dpp::snowflake id) {
+        ENSURE_LLM_CHANNEL_THREAD(id);
+        // Take channel right away if nobody else has it
+        auto [res, inserted] = current_llm_worker->channel_mailboxes.try_emplace(id);
+        if (inserted) return true;
+        auto& mailbox = res->second;
+        // Otherwise park until the channel is handed over to us
+        auto& task = CoSched::Task::get_current();
+        mailbox.waiting.push_back(&task);
+        task.set_suspended(true);
+        while (task.is_suspended()) {
+            if (!task.yield()) {
+                // Leave queue, or pass the channel on if it has already been handed over to us
+                auto pos = std::find(mailbox.waiting.begin(), mailbox.waiting.end(), &task);
+                if (pos != mailbox.waiting.end()) {
+                    mailbox.waiting.erase(pos);
+                } else {
+                    channel_release(id);
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+    // Must run in llama thread
+    void channel_release(dpp::snowflake id) {
+        ENSURE_LLM_CHANNEL_THREAD(id);
+        auto& channel_mailboxes = current_llm_worker->channel_mailboxes;
+        auto res = channel_mailboxes.find(id);
+        if (res == channel_mailboxes.end()) return;
+        auto& mailbox = res->second;
+        // Free channel if nobody is waiting for it
+        if (mailbox.waiting.empty()) {
+            channel_mailboxes.erase(res);
+            return;
+        }
+        // Otherwise hand it over to the next task
+        auto next = mailbox.waiting.front();
+        mailbox.waiting.pop_front();
+        next->set_suspended(false);
+    }
+    struct ChannelGuard {
+        Bot& bot;
+        dpp::snowflake id;
+
+        ~ChannelGuard() {
+            bot.channel_release(id);
+        }
+    };
+
+    // Must run in llama thread
+    bool prompt_add_msg(const dpp::message& msg, const BotChannelConfig& channel_cfg, bool defer = false) {
+        ENSURE_LLM_CHANNEL_THREAD(msg.channel_id);
+        // Format message
+        std::string text;
+        if (channel_cfg.instruct_mode) {
+            // Instruct mode user prompt as-is
+            text = (channel_cfg.model->no_extra_linebreaks?"\n":"\n\n")
+                   +msg.content
+                   +(channel_cfg.model->no_extra_linebreaks?"":"\n");
+        } else {
+            // Add prefix to each line
+            for (const auto line : utils::str_split(msg.content, '\n')) {
+                text += msg.author.username+": "+std::string(line)+'\n';
+            }
+            // Hold back history until a reply is needed or enough has been accumulated
+            auto& pending_history = current_llm_worker->pending_history;
+            auto& pending_entry = pending_history[msg.channel_id];
+            pending_entry.model_name = channel_cfg.model_name;
+            pending_entry.model = channel_cfg.model;
+            auto& pending = pending_entry.text;
+            pending += text;
+            // Drop what wouldn't fit into the context anyways (assuming no less than 4 characters per token)
+            const size_t max_pending = size_t(config.ctx_size) * 4;
+            if (pending.size() > max_pending) {
+                const auto pos = pending.find('\n', pending.size()-max_pending);
+                pending.erase(0, pos==std::string::npos?pending.size()-max_pending:pos+1);
+            }
+            if (defer && pending.size() < config.history_flush_size) {
+                return true;
+            }
+            text = std::move(pending);
+            pending_history.erase(msg.channel_id);
+        }
         // Get inference
         auto inference = llm_get_inference(msg.channel_id, channel_cfg);
         if (!inference) {
-            std::cerr << "Warning: Failed to get inference" << std::endl;
+            Logger::get().warning("llm", "Failed to get inference");
             return false;
         }
         std::string prefix;
@@ -252,128 +840,328 @@ private:
             // Show progress in console
             return show_console_progress(progress);
         };
-        // Instruct mode user prompt
-        if (channel_cfg.instruct_mode) {
-            // Append line as-is
-            if (!inference->append((channel_cfg.model->no_extra_linebreaks?"\n":"\n\n")
-                                                +msg.content
-                                                +(channel_cfg.model->no_extra_linebreaks?"":"\n"), cb)) {
-                std::cerr << "Warning: Failed to append user prompt: " << inference->get_last_error() << std::endl;
-                return false;
-            }
-        } else {
-            // Format and append lines
-            for (const auto line : utils::str_split(msg.content, '\n')) {
-                if (!inference->append(msg.author.username+": "+std::string(line)+'\n', cb)) {
-                    std::cerr << "Warning: Failed to append user prompt (single line): " << inference->get_last_error() << std::endl;
-                    return false;
-                }
-            }
+        // Append user prompt
+        utils::Timer prefill_timer;
+        if (!llm_append_chunked(msg.channel_id, inference, channel_cfg, text, cb)) {
+            Logger::get().warning("llm", "Failed to append user prompt: {}", inference->get_last_error());
+            return false;
         }
+        Logger::get().debug("llm", "Evaluated {} characters in {} ms", text.size(), prefill_timer.get());
         // Append line break on timeout
-        if (timeout_exceeded) return inference->append("\n");
+        if (timeout_exceeded) return llm_append(msg.channel_id, inference, "\n");
         return true;
     }
     // Must run in llama thread
-    bool prompt_add_trigger(const std::shared_ptr<LM::Inference>& inference, const BotChannelConfig& channel_cfg) {
+    void llm_flush_pending_history() {
         ENSURE_LLM_THREAD();
+        // Evaluate held back history so it's part of the stored contexts
+        auto& pending_history = current_llm_worker->pending_history;
+        while (!pending_history.empty()) {
+            const auto id = pending_history.begin()->first;
+            if (!channel_acquire(id)) return;
+            ChannelGuard channel_guard{*this, id};
+            auto res = pending_history.find(id);
+            if (res == pending_history.end()) continue;
+            auto pending = std::move(res->second);
+            pending_history.erase(res);
+            const BotChannelConfig channel_cfg{pending.model_name, pending.model, false};
+            auto inference = llm_get_inference(id, channel_cfg);
+            if (!inference || !llm_append_chunked(id, inference, channel_cfg, pending.text, show_console_progress)) {
+                Logger::get().warning("llm", "Failed to flush history of {}", uint64_t(id));
+            }
+        }
+    }
+    // Must run in llama thread
+    bool prompt_add_trigger(dpp::snowflake id, const std::shared_ptr<LM::Inference>& inference, const BotChannelConfig& channel_cfg) {
+        ENSURE_LLM_CHANNEL_THREAD(id);
         if (channel_cfg.instruct_mode) {
-            return inference->append((channel_cfg.model->no_extra_linebreaks?"":"\n")
+            return llm_append(id, inference, (channel_cfg.model->no_extra_linebreaks?"":"\n")
                                                  +channel_cfg.model->bot_prompt
                                                  +(channel_cfg.model->no_extra_linebreaks?"\n":"\n\n"));
         } else {
-            return inference->append(bot.me.username+':', show_console_progress);
+            return llm_append(id, inference, bot.me.username+':', show_console_progress);
         }
     }
 
+    std::shared_ptr<PendingMessage> message_create_async(const dpp::message& msg) {
+        auto fres = std::make_shared<PendingMessage>();
+        bot.message_create(msg, [fres] (const dpp::confirmation_callback_t& ccb) {
+            // Check for error, resulting message won't have an ID then
+            dpp::message msg;
+            if (ccb.is_error()) {
+                Logger::get().warning("bot", "Failed to create message: {}", ccb.get_error().message);
+            } else {
+                msg = ccb.get<dpp::message>();
+            }
+            // Wake up whoever is waiting for it
+            decltype(fres->waiters) waiters;
+            {
+                std::scoped_lock L(fres->mutex);
+                fres->msg = std::move(msg);
+                waiters.swap(fres->waiters);
+            }
+            for (const auto& wake : waiters) {
+                wake();
+            }
+        });
+        return fres;
+    }
     // Must run in llama thread
-    void reply(dpp::snowflake id, dpp::message& new_msg, const BotChannelConfig& channel_cfg) {
+    dpp::message llm_await(PendingMessage& pending) {
         ENSURE_LLM_THREAD();
+        {
+            std::scoped_lock L(pending.mutex);
+            if (pending.msg) return *pending.msg;
+        }
+        // Park until message has been created
+        llm_park([&pending] (std::function<void ()> wake) {
+            std::scoped_lock L(pending.mutex);
+            if (pending.msg) {
+                wake();
+            } else {
+                pending.waiters.push_back(std::move(wake));
+            }
+        });
+        std::scoped_lock L(pending.mutex);
+        return pending.msg.value_or(dpp::message());
+    }
+
+    // Must run in llama thread
+    void reply(dpp::snowflake id, const std::shared_ptr<PendingMessage>& placeholder, const BotChannelConfig& channel_cfg) {
+        ENSURE_LLM_CHANNEL_THREAD(id);
         // Get inference
         auto inference = llm_get_inference(id, channel_cfg);
         if (!inference) {
-            std::cerr << "Warning: Failed to get inference" << std::endl;
+            Logger::get().warning("llm", "Failed to get inference");
             return;
         }
         // Trigger LLM correctly
-        if (!prompt_add_trigger(inference, channel_cfg)) {
-            std::cerr << "Warning: Failed to add trigger to prompt: " << inference->get_last_error() << std::endl;
+        if (!prompt_add_trigger(id, inference, channel_cfg)) {
+            Logger::get().warning("llm", "Failed to add trigger to prompt: {}", inference->get_last_error());
             return;
         }
         if (CoSched::Task::get_current().is_dead()) {
             return;
         }
         // Run model
-        utils::Timer timeout;
-        utils::Timer edit_timer;
-        new_msg.content.clear();
+        utils::Timer timeout,
+                     edit_timer;
+        dpp::message new_msg(id, "");
+        auto current_msg = placeholder;
+        std::vector<std::pair<std::shared_ptr<PendingMessage>, std::string>> unsent; // Full messages that hadn't been created yet
+        unsigned msg_count = 1;
+        const size_t max_msg_size = 1995-std::max({config.texts.length_error.size(), config.texts.timeout.size(), config.texts.terminated.size()})-4;
         const std::string reverse_prompt = channel_cfg.instruct_mode?channel_cfg.model->user_prompt:"\n";
+        auto stop_matcher = channel_cfg.model->stop_matcher.get_cursor();
+        unsigned token_count = 0;
         uint8_t slow = 0;
         bool response_too_long = false;
         auto output = inference->run(reverse_prompt, [&] (std::string_view token) {
-            std::cout << token << std::flush;
+            // Journal what is evaluated as it is, output leaves out the reverse prompt
+            if (journal) journal->append(id, token);
             // Check for timeout
             if (!check_timeout(timeout, new_msg, slow)) return false;
-            // Make sure message isn't too long
-            if (new_msg.content.size() > 1995-config.texts.length_error.size()) {
-                response_too_long = true;
+            // Stop at stop sequence, leaving it out
+            const auto match_end = stop_matcher.feed(token);
+            if (match_end != token.npos) {
+                new_msg.content.append(token.substr(0, match_end));
+                new_msg.content.resize(new_msg.content.size()-std::min(stop_matcher.get_match_size(), new_msg.content.size()));
                 return false;
             }
-            // Edit live
-            if (config.live_edit) {
-                new_msg.content += token;
-                if (edit_timer.get<std::chrono::seconds>() > 3) {
-                    try {
-                        bot.message_edit(new_msg);
-                    } catch (...) {}
-                    edit_timer.reset();
+            new_msg.content += token;
+            // Get ID once message has been sent
+            if (new_msg.id.empty()) {
+                new_msg.id = current_msg->get_id();
+            }
+            // Continue in next message once this one is full
+            if (new_msg.content.size() > max_msg_size) {
+                auto rest = utils::split_message(new_msg.content, max_msg_size);
+                if (msg_count == config.max_reply_messages) {
+                    response_too_long = true;
+                    return false;
+                }
+                // Don't wait for the full message to be created in the middle of generation
+                if (!new_msg.id.empty()) {
+                    live_editor.finalize(id, new_msg.id, std::move(new_msg.content));
+                } else {
+                    unsent.emplace_back(current_msg, std::move(new_msg.content));
                 }
+                current_msg = message_create_async(dpp::message(id, rest.empty()?config.texts.please_wait:rest));
+                new_msg.content = std::move(rest);
+                new_msg.id = dpp::snowflake();
+                msg_count++;
             }
-            return true;
+            // Edit live once message has been sent, no need to hand content over more often than it could be sent
+            if (config.live_edit && !new_msg.id.empty() && edit_timer.get() >= config.live_edit_interval) {
+                live_editor.update(id, new_msg.id, new_msg.content);
+                edit_timer.reset();
+            }
+            // Stop at token limit
+            return ++token_count != channel_cfg.model->max_tokens;
         });
         if (output.empty()) {
-            std::cerr << "Warning: Failed to generate message: " << inference->get_last_error() << std::endl;
-            output = '<'+config.texts.empty_response+'>';
+            Logger::get().warning("llm", "Failed to generate message: {}", inference->get_last_error());
+            new_msg.content = '<'+config.texts.empty_response+'>';
+        }
+        if (config.log_tokens) {
+            Logger::get().info("llm", "Generated in {}: {}", uint64_t(id), output);
+        }
+        // Don't show reverse prompt
+        if (new_msg.content.ends_with(reverse_prompt)) {
+            new_msg.content.resize(new_msg.content.size()-reverse_prompt.size());
         }
-        std::cout << std::endl;
         // Handle message length error
         if (response_too_long) {
-            output += "...\n"+config.texts.length_error;
+            new_msg.content += "...\n"+config.texts.length_error;
         }
         // Handle timeout
         else if (slow == 2) {
-            output += "...\n"+config.texts.timeout;
+            new_msg.content += "...\n"+config.texts.timeout;
         }
         // Handle termination
         else if (CoSched::Task::get_current().is_dead()) {
-            output += "...\n"+config.texts.terminated;
+            new_msg.content += "...\n"+config.texts.terminated;
+        }
+        // Send messages that filled up before they had been created
+        for (auto& [pending, content] : unsent) {
+            const auto msg_id = llm_await(*pending).id;
+            if (!msg_id.empty()) {
+                live_editor.finalize(id, msg_id, std::move(content));
+            }
+        }
+        // Send last message
+        new_msg.id = llm_await(*current_msg).id;
+        if (!new_msg.id.empty()) {
+            live_editor.finalize(id, new_msg.id, std::move(new_msg.content));
+        }
+        // Other channels may have made the pool evict the context while we were parked
+        if (!llm_refetch_inference(id, inference, channel_cfg)) {
+            return;
         }
-        // Send resulting message
-        new_msg.content = std::move(output);
-        try {
-            bot.message_edit(new_msg);
-        } catch (...) {}
         // Tell model about length error
         if (response_too_long) {
-            inference->append("... Response interrupted due to length error");
+            llm_append(id, inference, "... Response interrupted due to length error");
         }
         // Prepare for next message
         if (!channel_cfg.instruct_mode || !channel_cfg.model->no_extra_linebreaks) {
-            inference->append("\n");
+            llm_append(id, inference, "\n");
         }
         if (channel_cfg.instruct_mode && channel_cfg.model->emits_eos) {
-            inference->append("\n"+channel_cfg.model->user_prompt);
+            llm_append(id, inference, "\n"+channel_cfg.model->user_prompt);
         }
     }
 
+    size_t get_pool_size() const {
+        // Fit largest contexts into memory budget
+        size_t context_size = 0;
+        for (const auto& [model_name, model] : config.models) {
+            if (!model.context_size && config.memory_budget) {
+                Logger::get().warning("llm", "Unknown format of model {}, size of its contexts can't be accounted for in memory budget", model_name);
+            }
+            context_size = std::max(context_size, model.context_size);
+        }
+        if (!config.memory_budget || !context_size) return config.pool_size;
+        // Compressed tier is part of the budget
+        const size_t budget = config.memory_budget-std::min(config.memory_budget, config.compressed_context_budget);
+        const size_t fres = std::max<size_t>(budget/context_size, config.llm_workers);
+        Logger::get().info("llm", "Keeping up to {} contexts of up to {} MB each in RAM", fres, context_size/1000000);
+        return fres;
+    }
+
+    std::string get_stats_text() {
+        std::string fres;
+        // Init caches
+        size_t init_caches_size = 0;
+        for (const auto& [name, cache] : init_caches) {
+            // Builders may still be writing the others
+            if (cache.ready) init_caches_size += cache.data.size();
+        }
+        const unsigned clones = init_cache_stats.hits+init_cache_stats.misses;
+        fres += fmt::format("Init caches: **{}** in RAM (**{} MB**), **{}** built, **{}** hits, **{}** misses, **{}** µs avg. clone latency\n",
+                            init_caches.size(), init_caches_size/1000000, init_cache_stats.builds.load(), init_cache_stats.hits.load(), init_cache_stats.misses.load(),
+                            clones?(init_cache_stats.clone_time/clones):0);
+        // Thread routing
+        {
+            std::shared_lock L(threads_mutex);
+            fres += fmt::format("Thread routing: **{}** threads cached, **{}** lookups (**{}** database queries saved)\n",
+                                threads.size(), thread_lookups.load(), thread_lookups*2);
+        }
+        // Thread filter
+        if (config.threads_only) {
+            fres += fmt::format("Thread filter: **{}** messages checked, **{}** passed, **{}** false positives\n",
+                                thread_filter_checks.load(), thread_filter_passes.load(), thread_filter_false_positives.load());
+        }
+        // Context memory
+        {
+            std::map<std::string, size_t> memory_usage;
+            size_t total = 0;
+            for (auto& worker : llm_workers) {
+                std::scoped_lock L(worker->memory_usage_mutex);
+                for (const auto& [model_name, size] : worker->memory_usage) {
+                    memory_usage[model_name] += size;
+                    total += size;
+                }
+            }
+            fres += fmt::format("Context memory: **{} MB**", total/1000000);
+            if (config.memory_budget) fres += fmt::format(" of **{} MB**", config.memory_budget/1000000);
+            for (const auto& [model_name, size] : memory_usage) {
+                fres += fmt::format(", {}: **{} MB**", model_name, size/1000000);
+            }
+            fres += '\n';
+        }
+        // Context tiers
+        const unsigned restores = pool_stats.ram_hits+pool_stats.compressed_hits+pool_stats.disk_hits+pool_stats.misses;
+        if (restores) {
+            fres += fmt::format("Context tiers: **{}%** RAM, **{}%** compressed (**{}** ms avg. promotion latency), **{}%** disk (**{}** ms avg. restore latency), **{}%** new\n",
+                                pool_stats.ram_hits*100/restores,
+                                pool_stats.compressed_hits*100/restores, pool_stats.compressed_hits?(pool_stats.promotion_time/pool_stats.compressed_hits/1000):0,
+                                pool_stats.disk_hits*100/restores, pool_stats.disk_hits?(pool_stats.disk_restore_time/pool_stats.disk_hits/1000):0,
+                                pool_stats.misses*100/restores);
+        }
+        if (compressed_store) {
+            fres += fmt::format("Compressed tier: **{}** contexts in **{} MB** (**{} MB** uncompressed), **{}** promoted, **{}** stale, **{}** dropped\n",
+                                compressed_store->get_size(), compressed_store->get_bytes()/1000000, compressed_store->get_bytes_uncompressed()/1000000,
+                                compressed_store->get_restores(), compressed_store->get_stale(), compressed_store->get_dropped());
+        }
+        fres += fmt::format("Prefetcher: **{}** files (**{} MB**) read ahead\n", prefetcher.get_files_read(), prefetcher.get_bytes_read()/1000000);
+        // Typing prefetch
+        if (config.typing_prefetch_budget) {
+            const unsigned predictions = typing_prefetch_stats.predictions,
+                           hits = typing_prefetch_stats.hits,
+                           unpredicted = pool_stats.disk_hits-hits;
+            const uint64_t hit_latency = hits?(typing_prefetch_stats.hit_restore_time/hits):0,
+                           miss_latency = unpredicted?((pool_stats.disk_restore_time-typing_prefetch_stats.hit_restore_time)/unpredicted):0;
+            fres += fmt::format("Typing prefetch: **{}** predictions, **{}%** accurate, **{}** expired, **{}** ms restore latency (**{}** ms without)\n",
+                                predictions, predictions?(hits*100/predictions):0, typing_prefetch_stats.expired.load(), hit_latency/1000, miss_latency/1000);
+        }
+        // Journal
+        if (journal) {
+            fres += fmt::format("Journal: **{} KB** written in **{}** syncs, **{}** entries replayed\n",
+                                journal->get_bytes_written()/1000, journal->get_syncs(), journal->get_replayed());
+        }
+        // Live edits
+        if (config.live_edit) {
+            fres += fmt::format("Live edits: **{}** sent, **{}** coalesced, **{}** rate limited\n",
+                                live_editor.get_edits_sent(), live_editor.get_edits_coalesced(), live_editor.get_edits_rate_limited());
+        }
+        // Logger
+        fres += fmt::format("Logger: **{}** messages dropped\n", Logger::get().get_dropped());
+        // User cache
+        const auto user_lookups = users.get_hits()+users.get_misses();
+        fres += fmt::format("User cache: **{}**/**{}** users, **{}%** hit rate\n",
+                            users.get_size(), config.user_cache_size, user_lookups?(users.get_hits()*100/user_lookups):0);
+        return fres;
+    }
+
     bool check_should_reply(const dpp::message& msg) {
         // Reply if message contains username, mention or ID
         if (msg.content.find(bot.me.username) != std::string::npos) {
             return true;
         }
         // Reply if message references user
-        for (const auto msg_id : my_messages) {
-            if (msg.message_reference.message_id == msg_id) {
+        if (!msg.message_reference.message_id.empty()) {
+            std::scoped_lock L(my_messages_mutex);
+            if (my_messages.contains(msg.message_reference.message_id)) {
                 return true;
             }
         }
@@ -387,21 +1175,131 @@ private:
         return false;
     }
 
+    dpp::snowflake get_own_message_oldest_id() const {
+        // Snowflakes start with their creation time in milliseconds since the Discord epoch
+        const uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        const uint64_t max_age = uint64_t(config.own_message_max_age) * 1000;
+        const uint64_t discord_epoch = 1420070400000;
+        if (now < discord_epoch + max_age) return 0;
+        return (now - discord_epoch - max_age) << 22;
+    }
+
+    void own_message_add(dpp::snowflake id) {
+        // Add to database
+        if (config.persistance) {
+            db.add_own_message(id);
+        }
+        // Add to set
+        std::scoped_lock L(my_messages_mutex);
+        my_messages.insert(id);
+        my_messages_by_age.push_back(id);
+    }
+    void own_messages_prune() {
+        const auto oldest_id = get_own_message_oldest_id();
+        // Remove from database
+        if (config.persistance) {
+            db.remove_own_messages_before(oldest_id);
+        }
+        // Remove from set
+        std::scoped_lock L(my_messages_mutex);
+        while (!my_messages_by_age.empty() && my_messages_by_age.front() < oldest_id) {
+            my_messages.erase(my_messages_by_age.front());
+            my_messages_by_age.pop_front();
+        }
+    }
+
+    std::optional<ThreadInfo> get_thread_info(dpp::snowflake id) {
+        std::shared_lock L(threads_mutex);
+        auto res = threads.find(id);
+        if (res == threads.end()) return {};
+        return res->second;
+    }
+
     bool is_on_own_shard(dpp::snowflake id) const {
         return (unsigned(id.get_creation_time()) % config.shard_count) == config.shard_id;
     }
 
     void cleanup() {
-        // Clean up InferencePool
-        if (config.max_context_age) llm_pool.cleanup(config.max_context_age);
+        // Forget about wrong typing predictions
+        typing_prefetch_expire();
+        // Clean up InferencePools
+        if (config.max_context_age) {
+            for (auto& worker : llm_workers) {
+                worker->sched_thread.create_task("Language Model Inference Pool Cleanup", [this, &worker = *worker] () -> void {
+                    worker.llm_pool.cleanup(config.max_context_age);
+                });
+            }
+        }
         // Reset timer
         cleanup_timer.reset();
     }
+    void journal_fold() {
+        if (!journal) return;
+        const auto channels = journal->get_recovered_channels();
+        if (channels.empty()) return;
+        Logger::get().info("llm", "Replaying journal of {} channels", channels.size());
+        // Replay into every recovered context and snapshot them so segments of previous run can be dropped
+        snapshot_running = true;
+        auto remaining = std::make_shared<std::atomic<size_t>>(channels.size());
+        for (const auto id : channels) {
+            get_llm_worker(id).sched_thread.create_task("Language Model Journal Replay ("+std::to_string(id)+")", [this, id, remaining] () -> void {
+                if (channel_acquire(id)) {
+                    ChannelGuard channel_guard{*this, id};
+                    // Get model the same way a message would
+                    BotChannelConfig channel_cfg{&config.default_inference_model, config.default_inference_model_cfg, false};
+                    if (const auto thread_info = get_thread_info(id)) {
+                        auto res = config.models.find(thread_info->model);
+                        if (res != config.models.end()) {
+                            channel_cfg = {&res->first, &res->second, thread_info->instruct_mode};
+                        } else {
+                            channel_cfg.model = nullptr;
+                        }
+                    }
+                    if (!channel_cfg.model || !llm_get_inference(id, channel_cfg)) {
+                        Logger::get().warning("llm", "Failed to replay journal of {}, discarding it", uint64_t(id));
+                    }
+                }
+                // Whatever hasn't been replayed by now won't ever be
+                journal->take_recovered(id, std::filesystem::file_time_type::max());
+                if (--*remaining == 0) {
+                    snapshot_running = false;
+                    snapshot();
+                }
+            });
+        }
+    }
+    void snapshot() {
+        if (!journal || snapshot_running.exchange(true)) return;
+        snapshot_timer.reset();
+        // Journal may be dropped up to the new segment once every context has been stored, its writer rotates so we don't wait for the disk here
+        journal->rotate_async([this] (unsigned segment) {
+            auto remaining = std::make_shared<std::atomic<unsigned>>(llm_workers.size());
+            for (auto& worker : llm_workers) {
+                worker->sched_thread.create_task("Language Model Snapshot", [this, &worker = *worker, segment, remaining] () -> void {
+                    llm_flush_pending_history();
+                    worker.llm_pool.store_all();
+                    if (--*remaining == 0) {
+                        journal->drop_segments_before(segment);
+                        snapshot_running = false;
+                    }
+                });
+            }
+        });
+    }
     void attempt_cleanup() {
+        // Snapshot contexts if enough time has passed
+        if (config.snapshot_interval && snapshot_timer.get<std::chrono::seconds>() > config.snapshot_interval) {
+            snapshot();
+        }
         // Run cleanup if enough time has passed
         if (cleanup_timer.get<std::chrono::seconds>() > config.max_context_age / 4) {
             cleanup();
         }
+        // Forget about old own messages every now and then, a few too many don't hurt
+        if (own_messages_prune_timer.get<std::chrono::seconds>() > std::max(config.own_message_max_age / 16, 60u)) {
+            own_messages_prune();
+            own_messages_prune_timer.reset();
+        }
     }
 
     std::string create_thread_name(const std::string& model_name, bool instruct_mode) const {
@@ -469,23 +1367,27 @@ private:
                               [this, event, model_name = res->first] (const dpp::confirmation_callback_t& ccb) {
                 // Check for error
                 if (ccb.is_error()) {
-                    std::cout << "Thread creation failed: " << ccb.get_error().message << std::endl;
+                    Logger::get().warning("bot", "Thread creation failed: {}", ccb.get_error().message);
                     event.reply(dpp::message(config.texts.thread_create_fail).set_flags(dpp::message_flags::m_ephemeral));
                     return;
                 }
-                std::cout << "Responsible for creating thread: " << ccb.get<dpp::thread>().id << std::endl;
+                Logger::get().info("bot", "Responsible for creating thread: {}", uint64_t(ccb.get<dpp::thread>().id));
                 // Report success
                 event.reply(dpp::message("Okay!").set_flags(dpp::message_flags::m_ephemeral));
             });
         } else {
             bool this_shard = is_on_own_shard(thread->id);
             // Add thread to database
-            db << "INSERT INTO threads (id, model, instruct_mode, this_shard) VALUES (?, ?, ?, ?);"
-               << std::to_string(thread->id) << model_name << instruct_mode << this_shard;
+            db.add_thread({thread->id, model_name, instruct_mode, this_shard});
+            {
+                std::unique_lock L(threads_mutex);
+                threads[thread->id] = {model_name, instruct_mode, this_shard};
+            }
+            if (this_shard) thread_filter.add(thread->id);
             // Stop if this is not the correct shard for thread finalization
             if (!this_shard) return false;
             // Set name
-            std::cout << "Responsible for finalizing thread: " << thread->id << std::endl;
+            Logger::get().info("bot", "Responsible for finalizing thread: {}", uint64_t(thread->id));
             thread->name = create_thread_name(model_name, instruct_mode);
             bot.channel_edit(*thread);
             // Send embed
@@ -494,7 +1396,7 @@ private:
                                [this, thread_id = thread->id] (const dpp::confirmation_callback_t& ccb) {
                 // Check for error
                 if (ccb.is_error()) {
-                    std::cerr << "Warning: Failed to create embed: " << ccb.get_error().message << std::endl;
+                    Logger::get().warning("bot", "Failed to create embed: {}", ccb.get_error().message);
                     return;
                 }
                 // Get message
@@ -509,27 +1411,62 @@ private:
 
 public:
     Bot(decltype(config) cfg)
-            : llm_pool(cfg.pool_size, "discord_llama", !cfg.persistance),
-              db("database.sqlite3"), bot(cfg.token), config(cfg) {
-        // Initialize database
-        db << "CREATE TABLE IF NOT EXISTS threads ("
-              "    id TEXT PRIMARY KEY NOT NULL,"
-              "    model TEXT,"
-              "    instruct_mode INTEGER,"
-              "    this_shard INTEGER,"
-              "    UNIQUE(id)"
-              ");";
-
-        // Start Scheduled Thread
-        sched_thread.start();
+            : users(cfg.user_cache_size), db("database.sqlite3"), bot(cfg.token), live_editor(bot, std::chrono::milliseconds(cfg.live_edit_interval)), config(cfg) {
+        // Load threads
+        db.load_threads([&](Database::Thread&& thread) {
+            if (thread.this_shard) thread_filter.add(thread.id);
+            threads[thread.id] = {std::move(thread.model), thread.instruct_mode, thread.this_shard};
+        });
+
+        // Load own messages
+        if (config.persistance) {
+            db.load_own_messages(get_own_message_oldest_id(), [&](uint64_t id) {
+                my_messages.insert(id);
+                my_messages_by_age.push_back(id);
+            });
+        }
+
+        // Keep contexts evicted from the pool compressed in RAM
+        if (config.compressed_context_budget) {
+            compressed_store.emplace(config.compressed_context_budget);
+        }
+
+        // Open journal, recovering what previous run didn't get to store
+        if (config.persistance) {
+            journal.emplace("journal", std::chrono::milliseconds(config.journal_sync_interval));
+        }
+
+        // Start LLM workers, each with its share of the pool
+        const size_t pool_size = get_pool_size();
+        for (unsigned id = 0; id != config.llm_workers; id++) {
+            const size_t worker_pool_size = pool_size/config.llm_workers + (id < pool_size%config.llm_workers);
+            auto& worker = *llm_workers.emplace_back(std::make_unique<LLMWorker>(id, worker_pool_size, config.persistance));
+            worker.sched_thread.start();
+            worker.sched_thread.create_task("Language Model Initialization", [this, &worker] () -> void {
+                                     llm_init(worker);
+                                 });
+        }
 
         // Configure bot
-        bot.on_log(dpp::utility::cout_logger());
+        bot.on_log([] (const dpp::log_t& event) {
+            Logger::Level level;
+            if (event.severity <= dpp::ll_debug) {
+                level = Logger::Level::debug;
+            } else if (event.severity == dpp::ll_info) {
+                level = Logger::Level::info;
+            } else if (event.severity == dpp::ll_warning) {
+                level = Logger::Level::warning;
+            } else {
+                level = Logger::Level::error;
+            }
+            Logger::get().log(level, "dpp", std::string(event.message));
+        });
         bot.intents = dpp::i_guild_messages | dpp::i_message_content | dpp::i_message_content;
+        if (config.typing_prefetch_budget) bot.intents |= dpp::i_guild_message_typing;
 
         // Set callbacks
         bot.on_ready([=, this] (const dpp::ready_t&) { //TODO: Consider removal
-            std::cout << "Connected to Discord." << std::endl;
+            Logger::get().info("bot", "Connected to Discord.");
             // Register chat command once
             if (dpp::run_once<struct register_bot_commands>()) {
                 auto register_command = [this] (dpp::slashcommand&& c) {
@@ -552,14 +1489,9 @@ public:
                 register_command(dpp::slashcommand("ping", "Check my status", bot.me.id));
                 register_command(dpp::slashcommand("reset", "Reset this conversation", bot.me.id));
                 register_command(dpp::slashcommand("tasklist", "Get list of tasks", bot.me.id));
+                register_command(dpp::slashcommand("stats", "Get performance statistics", bot.me.id));
                 //register_command(dpp::slashcommand("taskkill", "Kill a task", bot.me.id)); TODO
             }
-            if (dpp::run_once<class LM::Inference>()) {
-                // Prepare llm
-                sched_thread.create_task("Language Model Initialization", [this] () -> void {
-                                         llm_init();
-                                     });
-            }
         });
         bot.on_slashcommand([=, this](dpp::slashcommand_t event) {
             const auto invalidate_event = [this] (const dpp::slashcommand_t& event) {
@@ -583,9 +1515,16 @@ public:
                 return;
             } else if (command_name == "reset") {
                 // Delete inference from pool
-                sched_thread.create_task("Language Model Inference Pool", [this, id = event.command.channel_id, user = event.command.usr] () -> void {
+                get_llm_worker(event.command.channel_id).sched_thread.create_task("Language Model Inference Pool", [this, id = event.command.channel_id, user = event.command.usr] () -> void {
                     CoSched::Task::get_current().user_data = std::move(user);
-                    llm_pool.delete_inference(id);
+                    // Wait for tasks that are still working on the context
+                    if (!channel_acquire(id)) return;
+                    ChannelGuard channel_guard{*this, id};
+                    current_llm_worker->llm_pool.delete_inference(id);
+                    current_llm_worker->pool_slots.erase(id);
+                    current_llm_worker->pending_history.erase(id);
+                    if (journal) journal->reset(id);
+                    llm_update_memory_usage();
                 });
                 // Sender message
                 if (is_on_own_shard(event.command.channel_id)) {
@@ -595,33 +1534,64 @@ public:
                 invalidate_event(event);
                 return;
             } else if (command_name == "tasklist") {
-                // Build task list
-                sched_thread.create_task("tasklist", [this, event, id = event.command.channel_id, user = event.command.usr] () -> void {
+                // Build task list of each worker
+                for (auto& worker : llm_workers) {
+                    worker->sched_thread.create_task("tasklist", [this, event, id = event.command.channel_id, user = event.command.usr] () -> void {
+                        auto& task = CoSched::Task::get_current();
+                        task.user_data = std::move(user);
+                        // Set priority to max
+                        task.set_priority(CoSched::PRIO_REALTIME);
+                        // Header
+                        std::string str = "**__Task List on Shard "+std::to_string(config.shard_id)+", Worker "+std::to_string(current_llm_worker->id)+"__**\n";
+                        // Produce list
+                        for (const auto& task : task.get_scheduler().get_tasks()) {
+                            // Get user
+                            const dpp::user *user = nullptr;
+                            {
+                                if (task->user_data.has_value()) {
+                                    user = &std::any_cast<const dpp::user&>(task->user_data);
+                                }
+                            }
+                            // Append line
+                            str += fmt::format("- `{}` (State: **{}**, Priority: **{}**, User: **{}**)\n", task->get_name(), task->is_suspended()?"suspended":task->get_state_string(), task->get_priority(), user?user->format_username():bot.me.format_username());
+                        }
+                        // Produce list of channel queues
+                        if (!current_llm_worker->channel_mailboxes.empty()) {
+                            str += "**__Channel Queues__**\n";
+                            for (const auto& [channel_id, mailbox] : current_llm_worker->channel_mailboxes) {
+                                str += fmt::format("- <#{}> (Waiting: **{}**)\n", channel_id, mailbox.waiting.size());
+                            }
+                        }
+                        // Delete original thinking response
+                        if (current_llm_worker->id == 0 && is_on_own_shard(event.command.channel_id)) {
+                            event.delete_original_response();
+                        }
+                        // Send list
+                        bot.message_create(dpp::message(id, str));
+                        return;
+                    });
+                }
+                // Finalize
+                if (is_on_own_shard(event.command.channel_id)) {
+                    event.thinking(false);
+                }
+                return;
+            } else if (command_name == "stats") {
+                // Build statistics
+                get_llm_worker(event.command.channel_id).sched_thread.create_task("stats", [this, event, id = event.command.channel_id, user = event.command.usr] () -> void {
                     auto& task = CoSched::Task::get_current();
                     task.user_data = std::move(user);
                     // Set priority to max
                     task.set_priority(CoSched::PRIO_REALTIME);
-                    // Header
-                    std::string str = "**__Task List on Shard "+std::to_string(config.shard_id)+"__**\n";
-                    // Produce list
-                    for (const auto& task : task.get_scheduler().get_tasks()) {
-                        // Get user
-                        const dpp::user *user = nullptr;
-                        {
-                            if (task->user_data.has_value()) {
-                                user = &std::any_cast<const dpp::user&>(task->user_data);
-                            }
-                        }
-                        // Append line
-                        str += fmt::format("- `{}` (State: **{}**, Priority: **{}**, User: **{}**)\n", task->get_name(), task->is_suspended()?"suspended":task->get_state_string(), task->get_priority(), user?user->format_username():bot.me.format_username());
-                    }
+                    // Produce statistics
+                    std::string str = "**__Statistics on Shard "+std::to_string(config.shard_id)+"__**\n"
+                                      +get_stats_text();
                     // Delete original thinking response
                     if (is_on_own_shard(event.command.channel_id)) {
                         event.delete_original_response();
                     }
-                    // Send list
+                    // Send statistics
                     bot.message_create(dpp::message(id, str));
-                    return;
                 });
                 // Finalize
                 if (is_on_own_shard(event.command.channel_id)) {
@@ -632,6 +1602,18 @@ public:
             // Run command completion handler
             command_completion_handler(std::move(event));
         });
+        bot.on_typing_start([=, this](const dpp::typing_start_t& event) {
+            // Get context ready before message arrives
+            if (!config.typing_prefetch_budget || event.user_id == bot.me.id) return;
+            // Channel cache isn't filled without the guilds intent, so take the channel (or thread) ID from the payload
+            dpp::snowflake channel_id;
+            try {
+                channel_id = nlohmann::json::parse(event.raw_event)["d"]["channel_id"].get<std::string>();
+            } catch (...) {
+                return;
+            }
+            typing_prefetch(channel_id);
+        });
         bot.on_message_create([=, this](const dpp::message_create_t&) {
             // Attempt cleanup
             attempt_cleanup();
@@ -667,57 +1649,53 @@ public:
             });
         });
         bot.on_message_create([=, this] (const dpp::message_create_t& event) {
+            // Drop messages outside our threads as early as possible if we only reply in threads
+            if (config.threads_only) {
+                thread_filter_checks++;
+                if (!thread_filter.maybe_contains(event.msg.channel_id)) return;
+                thread_filter_passes++;
+            }
             // Update user cache
-            users[event.msg.author.id] = event.msg.author;
+            users.update(event.msg.author.id, event.msg.author.username);
             // Make sure message has content
             if (event.msg.content.empty()) return;
+            // Look up thread, this used to take database queries
+            thread_lookups++;
+            const auto thread_info = get_thread_info(event.msg.channel_id);
+            if (config.threads_only && !thread_info) thread_filter_false_positives++;
             // Ignore messges from channel on another shard
-            bool this_shard = is_on_own_shard(event.msg.channel_id);
-            db << "SELECT this_shard FROM threads "
-                  "WHERE id = ?;"
-                    << std::to_string(event.msg.channel_id)
-                    >> [&](int _this_shard) {
-                this_shard = _this_shard;
-            };
+            bool this_shard = thread_info?thread_info->this_shard:is_on_own_shard(event.msg.channel_id);
             if (!this_shard) return;
             // Ignore own messages
             if (event.msg.author.id == bot.me.id) {
                 // Add message to list of own messages
-                my_messages.push_back(event.msg.id);
+                own_message_add(event.msg.id);
                 return;
             }
             // Process message
             try {
                 // Copy message
                 dpp::message msg = event.msg;
-                // Replace bot mentions with bot username
-                utils::str_replace_in_place(msg.content, "<@"+std::to_string(bot.me.id)+'>', bot.me.username);
-                // Replace all other known users
-                for (const auto& [user_id, user] : users) {
-                    utils::str_replace_in_place(msg.content, "<@"+std::to_string(user_id)+'>', user.username);
-                }
+                // Replace mentions of bot and all other known users with their username
+                msg.content = utils::replace_mentions(msg.content, [this] (uint64_t user_id) -> std::optional<std::string> {
+                    if (user_id == bot.me.id) return bot.me.username;
+                    return users.get_username(user_id);
+                });
                 // Get channel config
                 BotChannelConfig channel_cfg;
                 // Attempt to find thread first...
-                bool in_bot_thread = false,
-                     model_missing = false;
-                db << "SELECT model, instruct_mode, this_shard FROM threads "
-                      "WHERE id = ?;"
-                        << std::to_string(msg.channel_id)
-                        >> [&](const std::string& model_name, int instruct_mode) {
-                    in_bot_thread = true;
-                    channel_cfg.instruct_mode = instruct_mode;
+                const bool in_bot_thread = thread_info.has_value();
+                if (in_bot_thread) {
+                    channel_cfg.instruct_mode = thread_info->instruct_mode;
                     // Find model
-                    auto res = config.models.find(model_name);
+                    auto res = config.models.find(thread_info->model);
                     if (res == config.models.end()) {
                         bot.message_create(dpp::message(msg.channel_id, config.texts.model_missing));
-                        model_missing = true;
                         return;
                     }
                     channel_cfg.model_name = &res->first;
                     channel_cfg.model = &res->second;
-                };
-                if (model_missing) return;
+                }
                 // Otherwise just fall back to the default model config if allowed
                 if (!in_bot_thread) {
                     if (config.threads_only) return;
@@ -725,33 +1703,11 @@ public:
                     channel_cfg.model = config.default_inference_model_cfg;
                 }
                 // Append message
-                sched_thread.create_task("Language Model Inference ("+*channel_cfg.model_name+" at "+std::to_string(msg.channel_id)+")", [=, this] () -> void {
+                get_llm_worker(msg.channel_id).sched_thread.create_task("Language Model Inference ("+*channel_cfg.model_name+" at "+std::to_string(msg.channel_id)+")", [=, this] () -> void {
                     CoSched::Task::get_current().user_data = msg.author;
-                    // Create initial message
-                    dpp::message placeholder_msg(msg.channel_id, config.texts.please_wait+" :thinking:");
-                    // Get task
-                    auto &task = CoSched::Task::get_current();
                     // Await previous completion
-                    while (true) {
-                        // Check that there are no other tasks with the same name
-                        bool is_unique = true;
-                        bool any_non_suspended = false;
-                        for (const auto& other_task : task.get_scheduler().get_tasks()) {
-                            if (&task == other_task.get()) continue;
-                            if (task.get_name() == other_task->get_name()) {
-                                is_unique = false;
-                            } else if (!other_task->is_suspended()) {
-                                any_non_suspended = true;
-                            }
-                        }
-                        // Stop looking if there is no task that isn't suspended
-                        if (!any_non_suspended) break;
-                        // Stop looking if task is unique
-                        if (is_unique) break;
-                        // Suspend, we'll be woken up by that other task
-                        task.set_suspended(true);
-                        if (!task.yield()) return;
-                    }
+                    if (!channel_acquire(msg.channel_id)) return;
+                    ChannelGuard channel_guard{*this, msg.channel_id};
                     // Check if message should reply
                     bool should_reply = false;
                     if (in_bot_thread) {
@@ -763,28 +1719,22 @@ public:
                         should_reply = check_should_reply(msg);
                     }
                     if (should_reply) {
-                        // Send placeholder
-                        placeholder_msg = bot.message_create_sync(placeholder_msg);
+                        // Send placeholder while prompt is being evaluated
+                        auto placeholder = message_create_async(dpp::message(msg.channel_id, config.texts.please_wait+" :thinking:"));
                         // Add user message
                         if (!prompt_add_msg(msg, channel_cfg)) {
-                            std::cerr << "Warning: Failed to add user message, not going to reply" << std::endl;
+                            Logger::get().warning("llm", "Failed to add user message, not going to reply");
                             return;
                         }
                         // Send a reply
-                        reply(msg.channel_id, placeholder_msg, channel_cfg);
+                        reply(msg.channel_id, placeholder, channel_cfg);
                     } else {
-                        // Add user message
-                        if (!prompt_add_msg(msg, channel_cfg)) {
-                            std::cerr << "Warning: Failed to add user message" << std::endl;
+                        // Add user message, evaluation may be deferred until a reply is needed
+                        if (!prompt_add_msg(msg, channel_cfg, true)) {
+                            Logger::get().warning("llm", "Failed to add user message");
                             return;
                         }
                     }
-                    // Unsuspend other tasks with same name
-                    for (const auto& other_task : task.get_scheduler().get_tasks()) {
-                        if (task.get_name() == other_task->get_name()) {
-                            other_task->set_suspended(false);
-                        }
-                    }
                 });
                 // Find thread embed
                 std::scoped_lock L(thread_embeds_mutex);
@@ -799,22 +1749,44 @@ public:
                 // Remove thread embed linkage from vector
                 thread_embeds.erase(res);
             } catch (const std::exception& e) {
-                std::cerr << "Warning: " << e.what() << std::endl;
+                Logger::get().warning("bot", "{}", e.what());
             }
         });
     }
 
+    ~Bot() {
+        // Stop init cache builders
+        {
+            std::scoped_lock L(init_cache_queue_mutex);
+            init_cache_builders_stop = true;
+        }
+        init_cache_queue_cv.notify_all();
+        for (auto& builder : init_cache_builders) {
+            builder.join();
+        }
+    }
+
     void start() {
         cleanup();
+        // Get own user early so init caches can be built before connecting
+        bot.me = bot.current_user_get_sync();
+        init_cache_start();
+        journal_fold();
         bot.start(dpp::st_wait);
     }
     void stop_prepare() {
-        if (config.persistance) {
-            sched_thread.create_task("Language Model Shutdown", [=, this] () -> void {
-                                     llm_pool.store_all();
-                                 });
+        for (auto& worker : llm_workers) {
+            if (config.persistance) {
+                worker->sched_thread.create_task("Language Model Shutdown", [this, &worker = *worker] () -> void {
+                                         llm_flush_pending_history();
+                                         worker.llm_pool.store_all();
+                                     });
+            }
+            worker->sched_thread.wait();
         }
-        sched_thread.wait();
+        // Everything has been stored
+        if (journal) journal->drop_segments_before(journal->rotate());
+        db.flush();
     }
 };
 
@@ -824,6 +1796,9 @@ int main(int argc, char **argv) {
     Configuration cfg;
     cfg.parse_configs(argc<2?"":argv[1]);
 
+    // Configure logger
+    Logger::get().set_level(cfg.log_level);
+
     // Construct and configure bot
     Bot bot(cfg);
 
@@ -0,0 +1,38 @@
+#include "user_cache.hpp"
+
+
+
+void UserCache::update(uint64_t id, const std::string& username) {
+    std::scoped_lock L(mutex);
+    // Update entry if it exists already
+    auto res = entries.find(id);
+    if (res != entries.end()) {
+        auto& entry = res->second;
+        entry.username = username;
+        lru.splice(lru.begin(), lru, entry.lru_pos);
+        return;
+    }
+    // Evict least recently used entry if full
+    if (entries.size() >= max_size && !lru.empty()) {
+        entries.erase(lru.back());
+        lru.pop_back();
+    }
+    // Add new entry
+    lru.push_front(id);
+    entries.emplace(id, Entry{username, lru.begin()});
+}
+
+std::optional<std::string> UserCache::get_username(uint64_t id) {
+    std::scoped_lock L(mutex);
+    // Find entry
+    auto res = entries.find(id);
+    if (res == entries.end()) {
+        misses++;
+        return {};
+    }
+    hits++;
+    // Mark as recently used
+    auto& entry = res->second;
+    lru.splice(lru.begin(), lru, entry.lru_pos);
+    return entry.username;
+}
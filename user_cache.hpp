@@ -0,0 +1,43 @@
+#ifndef USER_CACHE_HPP
+#define USER_CACHE_HPP
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <optional>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+
+class UserCache {
+    struct Entry {
+        std::string username;
+        std::list<uint64_t>::iterator lru_pos;
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, Entry> entries;
+    std::list<uint64_t> lru; // Most recently used first
+    size_t max_size;
+
+    std::atomic<uint64_t> hits = 0,
+                          misses = 0;
+
+public:
+    UserCache(size_t max_size) : max_size(max_size) {}
+
+    void update(uint64_t id, const std::string& username);
+    std::optional<std::string> get_username(uint64_t id);
+
+    size_t get_size() const {
+        std::scoped_lock L(mutex);
+        return entries.size();
+    }
+    uint64_t get_hits() const {
+        return hits;
+    }
+    uint64_t get_misses() const {
+        return misses;
+    }
+};
+#endif // USER_CACHE_HPP
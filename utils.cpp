@@ -1,8 +1,64 @@
 #include "utils.hpp"
 
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+
 
 
 namespace utils {
+StringMatcher::StringMatcher(const std::vector<std::string>& strings) {
+    // Build trie, 0 meaning no transition yet
+    nodes.emplace_back().next.fill(0);
+    for (const auto& str : strings) {
+        if (str.empty()) continue;
+        unsigned node = 0;
+        for (const unsigned char c : str) {
+            if (nodes[node].next[c] == 0) {
+                nodes[node].next[c] = nodes.size();
+                nodes.emplace_back().next.fill(0);
+            }
+            node = nodes[node].next[c];
+        }
+        nodes[node].match_size = str.size();
+    }
+    // Turn it into a complete automaton in breadth-first order
+    std::vector<unsigned> fail(nodes.size(), 0),
+                          queue;
+    for (unsigned c = 0; c != 256; c++) {
+        if (nodes[0].next[c]) queue.push_back(nodes[0].next[c]);
+    }
+    for (size_t idx = 0; idx != queue.size(); idx++) {
+        const unsigned node = queue[idx];
+        // Inherit match of longest proper suffix if there is none
+        if (!nodes[node].match_size) nodes[node].match_size = nodes[fail[node]].match_size;
+        for (unsigned c = 0; c != 256; c++) {
+            auto& next = nodes[node].next[c];
+            if (next) {
+                fail[next] = nodes[fail[node]].next[c];
+                queue.push_back(next);
+            } else {
+                next = nodes[fail[node]].next[c];
+            }
+        }
+    }
+}
+
+size_t StringMatcher::Cursor::feed(std::string_view text) {
+    const auto& nodes = matcher.nodes;
+    for (size_t idx = 0; idx != text.size(); idx++) {
+        state = nodes[state].next[static_cast<unsigned char>(text[idx])];
+        if (nodes[state].match_size) {
+            match_size = nodes[state].match_size;
+            state = 0;
+            return idx+1;
+        }
+    }
+    return text.npos;
+}
+
 std::vector<std::string_view> str_split(std::string_view s, char delimiter, size_t times) {
     std::vector<std::string_view> to_return;
     decltype(s.size()) start = 0, finish = 0;
@@ -25,6 +81,43 @@ void str_replace_in_place(std::string& subject, std::string_view search,
     }
 }
 
+std::string replace_mentions(std::string_view text, const std::function<std::optional<std::string> (uint64_t id)>& lookup) {
+    std::string fres;
+    fres.reserve(text.size());
+    size_t pos = 0;
+    while (pos != text.size()) {
+        // Find next potential mention
+        const auto start = text.find("<@", pos);
+        if (start == std::string_view::npos) break;
+        fres.append(text.substr(pos, start-pos));
+        // Parse it
+        auto idx = start+2;
+        if (idx != text.size() && text[idx] == '!') idx++;
+        const auto digits_start = idx;
+        uint64_t id = 0;
+        bool overflow = false;
+        while (idx != text.size() && isdigit(static_cast<unsigned char>(text[idx]))) {
+            const unsigned digit = text[idx]-'0';
+            if (id > (UINT64_MAX-digit)/10) overflow = true;
+            id = id*10 + digit;
+            idx++;
+        }
+        // Replace it if valid and known
+        if (idx != digits_start && !overflow && idx != text.size() && text[idx] == '>') {
+            if (const auto replacement = lookup(id)) {
+                fres.append(*replacement);
+                pos = idx+1;
+                continue;
+            }
+        }
+        // Keep it as-is otherwise
+        fres.append(text.substr(start, 2));
+        pos = start+2;
+    }
+    fres.append(text.substr(pos));
+    return fres;
+}
+
 void clean_for_command_name(std::string& value) {
     for (auto& c : value) {
         if (c == '.') c = '_';
@@ -51,4 +144,99 @@ std::string_view max_words(std::string_view text, unsigned count) {
     // Return resulting string
     return {text.data(), idx};
 }
+
+size_t get_chunk_size(std::string_view text, size_t max_size) {
+    if (!max_size || text.size() <= max_size) return text.size();
+    // Cut after a line break or before a space so words are tokenized as they would be otherwise
+    size_t pos = text.rfind('\n', max_size-1);
+    if (pos != text.npos) {
+        pos++;
+    } else {
+        pos = text.rfind(' ', max_size);
+    }
+    // Otherwise at least don't cut a character in half
+    if (pos == text.npos || pos == 0) {
+        pos = max_size;
+        while (pos != 0 && (text[pos] & 0xC0) == 0x80) pos--;
+        if (pos == 0) pos = max_size;
+    }
+    return pos;
+}
+
+std::string split_message(std::string& text, size_t max_size) {
+    constexpr std::string_view fence = "```";
+    // Leave room for closing a code block
+    const std::string_view head(text.data(), std::min(text.size(), max_size-fence.size()-1));
+    // Find last paragraph or code block boundary
+    size_t cut = 0;
+    bool in_code_block = false;
+    for (size_t idx = 0; idx < head.size(); idx++) {
+        if (head.substr(idx, fence.size()) == fence) {
+            in_code_block = !in_code_block;
+            if (in_code_block) {
+                // Cut before opening fence
+                if (idx == 0 || head[idx-1] == '\n') cut = idx;
+            } else {
+                // Cut after line of closing fence
+                const auto line_end = head.find('\n', idx);
+                if (line_end != head.npos) cut = line_end+1;
+            }
+            idx += fence.size()-1;
+        } else if (head.substr(idx, 2) == "\n\n") {
+            cut = idx+2;
+        }
+    }
+    // Fall back to line, then word, then character boundary if that would make the message too short
+    if (cut < head.size()/2) {
+        cut = head.rfind('\n');
+        if (cut == head.npos || cut < head.size()/2) cut = head.rfind(' ');
+        if (cut == head.npos || cut < head.size()/2) {
+            cut = head.size();
+            while (cut != 0 && cut < text.size() && (text[cut] & 0xC0) == 0x80) cut--;
+        } else {
+            cut++;
+        }
+    }
+    // Find out if cut is inside a code block
+    std::string_view language;
+    in_code_block = false;
+    for (size_t idx = head.find(fence); idx < cut; idx = head.find(fence, idx+fence.size())) {
+        in_code_block = !in_code_block;
+        if (in_code_block) {
+            const auto line_end = head.find('\n', idx);
+            language = head.substr(idx+fence.size(), std::min(line_end, cut)-idx-fence.size());
+        }
+    }
+    // Split
+    std::string fres;
+    if (in_code_block) {
+        fres.append(fence).append(language).push_back('\n');
+    }
+    const auto rest = std::string_view(text).substr(cut);
+    fres.append(rest.substr(std::min(rest.find_first_not_of('\n'), rest.size())));
+    text.resize(cut);
+    if (in_code_block) {
+        if (!text.empty() && text.back() != '\n') text.push_back('\n');
+        text.append(fence);
+    }
+    return fres;
+}
+
+uint64_t fnv1a(std::string_view data, uint64_t hash) {
+    for (const unsigned char c : data) {
+        hash ^= c;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+std::string read_file(const std::string& path, bool binary) {
+    std::ifstream f(path, binary?std::ios::binary:std::ios::in);
+    if (!f) {
+        throw std::runtime_error("Failed to open file: "+path);
+    }
+    std::ostringstream sstr;
+    sstr << f.rdbuf();
+    return sstr.str();
+}
 }
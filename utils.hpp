@@ -5,6 +5,11 @@
 #include <initializer_list>
 #include <vector>
 #include <chrono>
+#include <optional>
+#include <functional>
+#include <istream>
+#include <streambuf>
+#include <array>
 
 
 namespace utils {
@@ -28,14 +33,80 @@ public:
 };
 
 
+// Read-only stream over memory we don't own; avoids copying the buffer
+class MemoryStreamBuf : public std::streambuf {
+public:
+    MemoryStreamBuf(std::string_view data) {
+        auto p = const_cast<char*>(data.data());
+        setg(p, p, p+data.size());
+    }
+};
+class MemoryInputStream : public std::istream {
+    MemoryStreamBuf buf;
+
+public:
+    MemoryInputStream(std::string_view data) : std::istream(nullptr), buf(data) {
+        rdbuf(&buf);
+    }
+};
+
+
+// Aho-Corasick automaton finding any of a set of strings in text fed to it piece by piece, matches may span pieces
+class StringMatcher {
+    struct Node {
+        std::array<unsigned, 256> next;
+        size_t match_size = 0;
+    };
+
+    std::vector<Node> nodes;
+
+public:
+    // Position in a stream of text being matched
+    class Cursor {
+        const StringMatcher& matcher;
+        unsigned state = 0;
+        size_t match_size = 0;
+
+    public:
+        Cursor(const StringMatcher& matcher) : matcher(matcher) {}
+
+        // Returns offset just past first match in text or npos
+        size_t feed(std::string_view text);
+
+        // Size of last match, it might have started in previously fed text
+        size_t get_match_size() const {
+            return match_size;
+        }
+    };
+
+    StringMatcher(const std::vector<std::string>& strings = {});
+
+    Cursor get_cursor() const {
+        return Cursor(*this);
+    }
+};
+
 std::vector<std::string_view> str_split(std::string_view s, char delimiter, size_t times = -1);
 
 void str_replace_in_place(std::string& subject, std::string_view search, const std::string& replace);
 
+// Replaces <@id> and <@!id> mentions in a single pass, mentions the lookup returns nothing for are kept as-is
+std::string replace_mentions(std::string_view text, const std::function<std::optional<std::string> (uint64_t id)>& lookup);
+
 void clean_for_command_name(std::string& value);
 
 std::string_view max_words(std::string_view text, unsigned count);
 
+// Returns size of the first chunk of at most max_size bytes to evaluate text in, ending at a boundary that doesn't change tokenization
+size_t get_chunk_size(std::string_view text, size_t max_size);
+
+// Cuts text down to at most max_size bytes at a natural boundary and returns the rest, code blocks are closed and reopened across the cut
+std::string split_message(std::string& text, size_t max_size);
+
+uint64_t fnv1a(std::string_view data, uint64_t hash = 0xcbf29ce484222325);
+
+std::string read_file(const std::string& path, bool binary = false);
+
 inline
 uint32_t get_unique_color(const auto& input) {
     auto i = std::hash<typename std::remove_const<typename std::remove_reference<decltype(input)>::type>::type>{}(input);